@@ -3,6 +3,8 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <cassert>
+#include "residuetable.h"
 
 using namespace std;
 
@@ -177,11 +179,11 @@ std::ostream& operator<<(std::ostream& os, const Number& num)
 bool check(const Number& num) {
   if (!num.uniqueDigits())
     return false;
-  
-  for (int i = 1; i <= 10; ++i)
-    if (!num.biggestN(i).isDivisibleBy(i))
-      return false;
-  return true;
+
+  // digits_ is least significant first, so flip it to check the biggest i digits for each i.
+  static const ResidueTable place_residues(10);
+  vector<int> digits(num.digits_.rbegin(), num.digits_.rend());
+  return place_residues.prefixesDivisible(digits.data(), digits.size());
 }
 
 void confirmSolution(const Number& num)
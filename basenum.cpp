@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <algorithm>
 #include "cxxopts.hpp"
+#include "residuetable.h"
 
 using namespace std;
 
@@ -29,7 +30,7 @@ ostream& operator<<(ostream& out, const vector<T>& vec)
 class BaseNum
 {
 public:
-  BaseNum(uint16_t base) : base_(base)
+  BaseNum(uint16_t base) : base_(base), place_residues_(base)
   {
     // Note that our use of next_permutation means digits_ must be sorted
     // or we will silently get the wrong answer.
@@ -52,7 +53,10 @@ public:
     //   cout << status() << endl;
   }
 
-  BaseNum(uint16_t base, const std::vector<uint16_t>& digits) : base_(base), digits_(digits)
+  BaseNum(uint16_t base, const std::vector<uint16_t>& digits) :
+    base_(base),
+    digits_(digits),
+    place_residues_(base)
   {
     exps_.resize(base_);
     for (size_t i = 0; i < exps_.size(); ++i)
@@ -68,27 +72,18 @@ public:
     return flag;
   }
 
-  // Check if this one satisfies the rule, and recursively call on its prefixes.
+  // Check if this one satisfies the rule: no leading zero, and each prefix divisible by its length.
+  // The prefix residues come from the place value residue table, so no prefixes are built.
   bool isSolution() const
   {
-    if (digits_.size() == 1)
-      return (digits_[0] != 0);
-    
-    if (val_ % digits_.size() != 0)
+    if (digits_.empty() || digits_[0] == 0)
       return false;
 
-    return prefix().isSolution();
+    return place_residues_.prefixesDivisible(digits_.data(), digits_.size());
   }
   
   uint64_t val() const { return val_; }
 
-  // Chop off the last digit.
-  BaseNum prefix() const
-  {
-    vector<uint16_t> newdigits(digits_.begin(), digits_.begin() + digits_.size() - 1);
-    return BaseNum(base_, newdigits);
-  }
-
   std::string status(const std::string& prefix = "") const
   {
     ostringstream oss;
@@ -101,6 +96,7 @@ private:
   uint64_t val_;
   vector<uint16_t> digits_;
   vector<uint64_t> exps_;
+  ResidueTable place_residues_;
   
   uint64_t digits2val()
   {
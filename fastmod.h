@@ -0,0 +1,35 @@
+#ifndef FASTMOD_H
+#define FASTMOD_H
+
+#include <cstdint>
+
+// A divisor that's fixed at startup, with a precomputed reciprocal so that remainders and
+// divisibility tests are a few multiplications instead of a hardware division.
+// This is Lemire, Kaser and Kurz's fastmod ("Faster Remainder by Direct Computation", 2019):
+// with m = ceil(2^128 / d), the low 128 bits of m * a are the fractional part of a / d,
+// and the high bits of that times d are a mod d.  It's exact for every 64-bit a and d.
+class FastMod
+{
+public:
+  FastMod(uint64_t d = 1) :
+    d_(d),
+    m_(~(unsigned __int128)0 / d + 1)
+  {}
+
+  uint64_t mod(uint64_t a) const
+  {
+    unsigned __int128 frac = m_ * a;
+    unsigned __int128 low = (unsigned __int128)(uint64_t)frac * d_ >> 64;
+    unsigned __int128 high = (unsigned __int128)(uint64_t)(frac >> 64) * d_;
+    return (uint64_t)((high + low) >> 64);
+  }
+
+  // a is divisible by d exactly when the fractional part of a / d is less than 1 / d.
+  bool divides(uint64_t a) const { return m_ * a <= m_ - 1; }
+
+private:
+  uint64_t d_;
+  unsigned __int128 m_;
+};
+
+#endif // FASTMOD_H
@@ -0,0 +1,74 @@
+#ifndef RESIDUETABLE_H
+#define RESIDUETABLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "fastmod.h"
+
+// base^j mod k for every position k in 1..base and every exponent j in 0..base-1,
+// built once per base.  With it, the residue of any prefix mod any position is a sum
+// of small-integer products, so nothing ever has to build the prefix's full value.
+class ResidueTable
+{
+public:
+  ResidueTable(uint16_t base) :
+    base_(base)
+  {
+    table_.resize((base_ + 1) * base_, 0);
+    divisors_.resize(base_ + 1);
+    for (uint32_t k = 1; k <= base_; ++k) {
+      divisors_[k] = FastMod(k);
+      uint32_t residue = 1 % k;
+      for (uint32_t j = 0; j < base_; ++j) {
+        table_[k * base_ + j] = residue;
+        residue = residue * base_ % k;
+      }
+    }
+  }
+
+  uint16_t base() const { return base_; }
+
+  // base^j mod k.
+  uint16_t placeResidue(uint16_t k, size_t j) const { return table_[k * base_ + j]; }
+
+  // Position k as a divisor, for taking remainders mod k without a division.
+  const FastMod& divisor(uint16_t k) const { return divisors_[k]; }
+
+  // The number formed by the first len digits, most significant first, mod k.
+  // Each term is less than base^2, so the sum can't overflow for any base we support,
+  // and only needs reducing once at the end.
+  template<typename Digit>
+  uint32_t prefixResidue(const Digit* digits, size_t len, uint16_t k) const
+  {
+    return divisors_[k].mod(placeSum(digits, len, k));
+  }
+
+  // Whether each of the first len digits' prefixes is divisible by its length.
+  template<typename Digit>
+  bool prefixesDivisible(const Digit* digits, size_t len) const
+  {
+    for (size_t k = 1; k <= len; ++k)
+      if (!divisors_[k].divides(placeSum(digits, k, k)))
+        return false;
+    return true;
+  }
+
+private:
+  // The sum of each of the first len digits times its place value mod k, which is congruent
+  // to their number mod k.
+  template<typename Digit>
+  uint32_t placeSum(const Digit* digits, size_t len, uint16_t k) const
+  {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; ++i)
+      sum += (uint32_t)digits[i] * placeResidue(k, len - i - 1);
+    return sum;
+  }
+
+  uint16_t base_;
+  std::vector<uint16_t> table_;  // table_[k * base_ + j] is base_^j mod k.
+  std::vector<FastMod> divisors_;  // divisors_[k] is k, for k in 1..base_.
+};
+
+#endif // RESIDUETABLE_H
@@ -4,9 +4,24 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <limits>
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <map>
+#include <unordered_map>
 #include <cxxopts.hpp>
 #include <boost/multiprecision/cpp_int.hpp>
 #include <Eigen/Eigen>
+#include "fastmod.h"
+#include "residuetable.h"
 
 using namespace std;
 using namespace Eigen;
@@ -25,12 +40,51 @@ int symmetryViolation(const MatrixXi& mat)
   return num;
 }
 
-BigUInt ipow(BigUInt base, BigUInt exp)
+// Matrix form of a number.  Each column corresponds to one position, with a one in the row
+// of the digit in that position.  Zero goes in the last row.
+MatrixXi digits2Matrix(const std::vector<uint16_t>& digits)
 {
-  BigUInt result = 1;
-  for (int i = 0; i < exp; ++i)
-    result *= base;
-  return result;
+  MatrixXi m = MatrixXi::Zero(digits.size(), digits.size());
+  for (size_t i = 0; i < digits.size(); ++i) {
+    // Ignore out of bounds digits.
+    if (digits[i] >= m.rows())
+      continue;
+    else if (digits[i] != 0)
+      m(digits[i] - 1, i) = 1;
+    else
+      m(digits.size() - 1, i) = 1;
+  }
+  return m;
+}
+
+// Same as symmetryViolation(digits2Matrix(digits)), but working directly on the digits.
+// The one for position p is in row d, counting from 1, and its transpose is there if
+// position d holds the digit for row p.
+int symmetryViolation(const std::vector<uint16_t>& digits)
+{
+  size_t n = digits.size();
+  auto row = [&](size_t p) { return digits[p-1] == 0 ? n : digits[p-1]; };
+  int num = 0;
+  for (size_t p = 1; p <= n; ++p) {
+    if (digits[p-1] >= n || row(p) == p)
+      continue;
+    size_t d = row(p);
+    num += (digits[d-1] >= n || row(d) != p);
+  }
+  return num;
+}
+
+
+// The smallest max symmetry violation that a heuristic search finds this solution with.
+// That's the biggest symmetry violation of the leading blocks of its matrix form, except for
+// the whole matrix, since the last digit is always zero and never checked.
+int pathViolation(const std::vector<uint16_t>& digits)
+{
+  MatrixXi m = digits2Matrix(digits);
+  int violation = 0;
+  for (int n = 1; n < m.rows(); ++n)
+    violation = max(violation, symmetryViolation(m.block(0, 0, n, n)));
+  return violation;
 }
 
 template<typename T>
@@ -46,186 +100,2284 @@ ostream& operator<<(ostream& out, const vector<T>& vec)
   return out;
 }
 
+uint64_t gcd(uint64_t a, uint64_t b)
+{
+  while (b != 0) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// The number of trailing digits that decide divisibility by k in this base, i.e. the smallest
+// j such that k divides base^j, or zero if there isn't one.  k is at most 143 < 2^8, so if
+// there's such a j at all it's less than 8.
+uint16_t trailingDigitsFor(uint16_t base, uint16_t k)
+{
+  uint64_t power = base % k;
+  for (uint16_t j = 1; j <= 8; ++j) {
+    if (power == 0)
+      return j;
+    power = power * base % k;
+  }
+  return 0;
+}
+
+// How TreeSearch decides divisibility by a position, from cheapest to most general.
+// Since base = 1 mod any k dividing base - 1, a number is congruent to its digit sum mod k.
+// Likewise base = -1 mod any k dividing base + 1, so a number is congruent to the
+// alternating sum of its digits, starting with a plus sign on the last one.  If k divides
+// base^j, only the last j digits matter.  Everything else needs a full residue.
+enum class DivisibilityRule { DigitSum, AlternatingSum, TrailingDigits, General };
+
+DivisibilityRule divisibilityRule(uint16_t base, uint16_t k)
+{
+  if ((base - 1) % k == 0)
+    return DivisibilityRule::DigitSum;
+  if ((base + 1) % k == 0)
+    return DivisibilityRule::AlternatingSum;
+  if (trailingDigitsFor(base, k) > 0)
+    return DivisibilityRule::TrailingDigits;
+  return DivisibilityRule::General;
+}
+
+// Greedily group positions 2 through base into chunks, each with a modulus equal to the lcm of
+// its positions, leaving out the ones that aren't General if general_only.  The moduli are kept
+// small enough that residue * base + digit can't overflow.  chunk_of[k] is the index of the
+// modulus position k divides; a position left out gets the chunk of the next one after it, if
+// any, and chunk_of[base + 1] is the number of moduli.
+void groupModuli(uint16_t base, bool general_only, vector<uint64_t>* moduli,
+                 vector<size_t>* chunk_of)
+{
+  uint64_t max_modulus = numeric_limits<uint64_t>::max() / base;
+  moduli->assign(1, 1);
+  chunk_of->assign(base + 2, 0);
+  vector<bool> grouped(base + 1, false);
+  for (uint16_t k = 2; k <= base; ++k) {
+    if (general_only && divisibilityRule(base, k) != DivisibilityRule::General)
+      continue;
+    uint64_t m = moduli->back();
+    uint64_t g = gcd(m, k);
+    if (m / g <= max_modulus / k)
+      moduli->back() = m / g * k;
+    else
+      moduli->push_back(k);
+    (*chunk_of)[k] = moduli->size() - 1;
+    grouped[k] = true;
+  }
+
+  (*chunk_of)[base + 1] = moduli->size();
+  for (uint16_t k = base; k >= 1; --k)
+    if (!grouped[k])
+      (*chunk_of)[k] = (*chunk_of)[k + 1];
+}
+
+// The residue mod pos that the digit in position pos needs, given the residue mod pos
+// of the digits before it.
+uint64_t nextDigitResidue(const ResidueTable& place_residues, uint16_t pos, uint64_t residue)
+{
+  uint64_t shifted = place_residues.divisor(pos).mod(residue * place_residues.base());
+  return shifted == 0 ? 0 : pos - shifted;
+}
+
+// Returns true if base^base, and therefore every number we can form in this base,
+// fits in T without overflowing.
+template<typename T>
+bool fitsBase(uint16_t base)
+{
+  const T max_val = ~T(0);
+  T val = 1;
+  for (uint16_t i = 0; i < base; ++i) {
+    if (val > max_val / base)
+      return false;
+    val *= base;
+  }
+  return true;
+}
+
+// Tracks the exact value of the number so far, in an unchecked integer type T.
+// This is the reference implementation; ResidueTracker is much faster.
+template<typename T>
+class ValueTracker
+{
+public:
+  ValueTracker(uint16_t base) :
+    base_(base),
+    value_(0)
+  {
+    // Prove once, up front, that no prefix can overflow T, so the arithmetic
+    // in push() doesn't need to be checked.
+    if (!fitsBase<T>(base_)) {
+      cout << "Overflow detected: base " << base_ << " doesn't fit in the value type." << endl;
+      assert(false);
+    }
+    prefix_values_.reserve(base_);
+  }
+
+  // Shift the parent's value up by one place and add the new digit,
+  // rather than recomputing the whole prefix from place values.
+  void push(uint16_t digit)
+  {
+    prefix_values_.push_back(value_);
+    value_ = value_ * base_ + digit;
+  }
+
+  void pop()
+  {
+    value_ = prefix_values_.back();
+    prefix_values_.pop_back();
+  }
+
+  // The number so far mod k.
+  uint64_t residue(uint16_t k) const { return static_cast<uint64_t>(value_ % k); }
+  bool divides(uint16_t k) const { return value_ % k == 0; }
+  
+private:
+  uint16_t base_;
+  T value_;
+  vector<T> prefix_values_;  // prefix_values_[i] is the value of the first i digits.
+};
+
+// Tracks only the residues of the number so far, modulo a few combined moduli
+// that fit in a machine word.  Position k is checked against whichever modulus
+// k divides, so every node costs a handful of 64-bit operations regardless of base.
+// Only the positions with the General divisibility rule are tracked, since TreeSearch
+// handles the rest itself.
+class ResidueTracker
+{
+public:
+  ResidueTracker(uint16_t base) :
+    base_(base),
+    depth_(0)
+  {
+    // Any other position gets the chunk of the next general position after it, since that's
+    // the first chunk push() needs to keep up to date at that depth.
+    groupModuli(base_, true, &moduli_, &chunk_of_);
+
+    // residues_[i * moduli_.size() + c] is the first i digits mod moduli_[c].
+    residues_.resize((base_ + 1) * moduli_.size(), 0);
+
+    // Every remainder we take is by one of these, so precompute their reciprocals.
+    for (size_t c = 0; c < moduli_.size(); ++c)
+      chunk_divisors_.push_back(FastMod(moduli_[c]));
+    position_divisors_.resize(base_ + 1);
+    for (uint16_t k = 1; k <= base_; ++k)
+      position_divisors_[k] = FastMod(k);
+  }
+
+  void push(uint16_t digit)
+  {
+    size_t num_chunks = moduli_.size();
+    const uint64_t* parent = &residues_[depth_ * num_chunks];
+    uint64_t* child = &residues_[(depth_ + 1) * num_chunks];
+    ++depth_;
+
+    // Chunks are in order of position, so the ones before the chunk of the
+    // current position only cover positions we've already checked.
+    for (size_t c = chunk_of_[depth_]; c < num_chunks; ++c)
+      child[c] = chunk_divisors_[c].mod(parent[c] * base_ + digit);
+  }
+
+  void pop() { --depth_; }
+
+  // The number so far mod k.  k must be a general position, and at least the current number
+  // of digits, since chunks that only cover earlier positions aren't kept up to date.
+  uint64_t residue(uint16_t k) const
+  {
+    return position_divisors_[k].mod(residues_[depth_ * moduli_.size() + chunk_of_[k]]);
+  }
+
+  // Whether k divides the number so far, with the same restrictions on k as residue().
+  bool divides(uint16_t k) const
+  {
+    return position_divisors_[k].divides(residues_[depth_ * moduli_.size() + chunk_of_[k]]);
+  }
+
+private:
+  uint16_t base_;
+  size_t depth_;
+  vector<uint64_t> moduli_;
+  vector<size_t> chunk_of_;  // chunk_of_[k] is the index of the modulus that position k divides.
+  vector<uint64_t> residues_;
+  vector<FastMod> chunk_divisors_;  // chunk_divisors_[c] is moduli_[c].
+  vector<FastMod> position_divisors_;  // position_divisors_[k] is k.
+};
+
+// A set of digits, as a bitmask of W 64-bit words.  The candidates for a position are a few
+// word-wide ANDs away, and iterating over them with count-trailing-zeros only touches
+// the digits that are actually in the set.
+template<int W>
+class DigitSet
+{
+public:
+  DigitSet()
+  {
+    for (int i = 0; i < W; ++i)
+      words_[i] = 0;
+  }
+
+  // The digits lo through hi-1.
+  static DigitSet range(uint16_t lo, uint16_t hi)
+  {
+    DigitSet set;
+    for (uint16_t d = lo; d < hi; ++d)
+      set.insert(d);
+    return set;
+  }
+
+  void insert(uint16_t d) { words_[d / 64] |= uint64_t(1) << (d % 64); }
+  void erase(uint16_t d) { words_[d / 64] &= ~(uint64_t(1) << (d % 64)); }
+  bool contains(uint16_t d) const { return (words_[d / 64] >> (d % 64)) & 1; }
+
+  bool empty() const
+  {
+    for (int i = 0; i < W; ++i)
+      if (words_[i])
+        return false;
+    return true;
+  }
+
+  size_t size() const
+  {
+    size_t num = 0;
+    for (int i = 0; i < W; ++i)
+      num += __builtin_popcountll(words_[i]);
+    return num;
+  }
+
+  // Removes and returns the smallest digit.  The set must not be empty.
+  uint16_t popFront()
+  {
+    int i = 0;
+    while (words_[i] == 0)
+      ++i;
+    uint16_t d = i * 64 + __builtin_ctzll(words_[i]);
+    words_[i] &= words_[i] - 1;
+    return d;
+  }
+
+  DigitSet operator&(const DigitSet& other) const
+  {
+    DigitSet set;
+    for (int i = 0; i < W; ++i)
+      set.words_[i] = words_[i] & other.words_[i];
+    return set;
+  }
+
+  // The digits in this set but not in other.
+  DigitSet operator-(const DigitSet& other) const
+  {
+    DigitSet set;
+    for (int i = 0; i < W; ++i)
+      set.words_[i] = words_[i] & ~other.words_[i];
+    return set;
+  }
+
+  const uint64_t* words() const { return words_; }
+  uint64_t* words() { return words_; }
+
+  // So that digit sets can be map keys.
+  bool operator<(const DigitSet& other) const
+  {
+    return lexicographical_compare(words_, words_ + W, other.words_, other.words_ + W);
+  }
+
+  vector<uint16_t> digits() const
+  {
+    vector<uint16_t> digits;
+    DigitSet set = *this;
+    while (!set.empty())
+      digits.push_back(set.popFront());
+    return digits;
+  }
+  
+private:
+  uint64_t words_[W];
+};
+
+template<int W>
+ostream& operator<<(ostream& out, const DigitSet<W>& set)
+{
+  return out << "{" << set.digits() << "}";
+}
+
+// Forward checking: the candidates for position pos that leave something to put in position
+// pos + 1.  next_unused is the unused digits allowed there, next_progressions[r] is the nonzero
+// digits congruent to r mod pos + 1, and next_residue is the digits before pos mod pos + 1.
+template<int W>
+DigitSet<W> forwardCheck(DigitSet<W> candidates, const DigitSet<W>& next_unused,
+                         const vector<DigitSet<W>>& next_progressions,
+                         const ResidueTable& place_residues, size_t pos, uint64_t next_residue)
+{
+  const FastMod& next_divisor = place_residues.divisor(pos + 1);
+  DigitSet<W> remaining = candidates;
+  while (!remaining.empty()) {
+    uint16_t digit = remaining.popFront();
+    uint64_t child_residue = next_divisor.mod(next_residue * place_residues.base() + digit);
+    DigitSet<W> next = next_unused &
+      next_progressions[nextDigitResidue(place_residues, pos + 1, child_residue)];
+    next.erase(digit);
+    if (next.empty())
+      candidates.erase(digit);
+  }
+  return candidates;
+}
+
+// A subtree of the search, rooted at a prefix that has already passed all the checks.
+struct SearchTask
+{
+  vector<uint16_t> prefix;
+  // If non-empty, only these digits are tried in the position after the prefix.
+  vector<uint16_t> candidates;
+};
+
+// Everything needed to pick a search back up where it left off: the work still to do,
+// and what the work already done has found.
+struct Checkpoint
+{
+  uint16_t base;
+  bool heuristic;
+  int max_symmetry_violation;
+  bool involution;
+  int shard_index;
+  int num_shards;
+  uint64_t num_evals;
+  // evals_by_threshold[t] is how many of the num evals are under nodes whose path has
+  // a max symmetry violation of t.  See TreeSearch::evalsByThreshold().
+  vector<uint64_t> evals_by_threshold;
+  vector<vector<uint16_t>> solutions;
+  vector<SearchTask> tasks;
+
+  // Writes to a temporary file first, so a crash mid-write can't clobber the last good checkpoint.
+  bool save(const string& path) const
+  {
+    string tmp_path = path + ".tmp";
+    {
+      ofstream out(tmp_path.c_str());
+      out << "treesearch-checkpoint 1" << endl;
+      out << "base " << base << endl;
+      out << "heuristic " << heuristic << endl;
+      out << "max_symmetry_violation " << max_symmetry_violation << endl;
+      out << "involution " << involution << endl;
+      out << "shard " << shard_index << " " << num_shards << endl;
+      out << "num_evals " << num_evals << endl;
+      out << "evals_by_threshold ";
+      writeList(out, evals_by_threshold);
+      out << "solutions " << solutions.size() << endl;
+      for (size_t i = 0; i < solutions.size(); ++i)
+        writeList(out, solutions[i]);
+      out << "tasks " << tasks.size() << endl;
+      for (size_t i = 0; i < tasks.size(); ++i) {
+        writeList(out, tasks[i].prefix);
+        writeList(out, tasks[i].candidates);
+      }
+      if (!out)
+        return false;
+    }
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+  }
+
+  bool load(const string& path)
+  {
+    ifstream in(path.c_str());
+    string magic, key;
+    int version = 0;
+    size_t num_solutions = 0, num_tasks = 0;
+    in >> magic >> version;
+    if (magic != "treesearch-checkpoint" || version != 1)
+      return false;
+    in >> key >> base >> key >> heuristic >> key >> max_symmetry_violation;
+    in >> key >> involution;
+    in >> key >> shard_index >> num_shards >> key >> num_evals >> key;
+    readList(in, &evals_by_threshold);
+    in >> key >> num_solutions;
+    solutions.resize(num_solutions);
+    for (size_t i = 0; i < solutions.size(); ++i)
+      readList(in, &solutions[i]);
+    in >> key >> num_tasks;
+    tasks.resize(num_tasks);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      readList(in, &tasks[i].prefix);
+      readList(in, &tasks[i].candidates);
+    }
+    return (bool)in;
+  }
+
+private:
+  // Writes the size and then the values, all on one line.
+  template<typename T>
+  static void writeList(ostream& out, const vector<T>& values)
+  {
+    out << values.size();
+    for (size_t i = 0; i < values.size(); ++i)
+      out << " " << values[i];
+    out << endl;
+  }
+
+  template<typename T>
+  static void readList(istream& in, vector<T>* values)
+  {
+    size_t size = 0;
+    in >> size;
+    values->resize(size);
+    for (size_t i = 0; i < size; ++i)
+      in >> (*values)[i];
+  }
+};
+
+// Each thread works from the back of its own deque of tasks, and when that runs dry
+// steals from the front of the other threads' deques.  Running threads split off
+// more tasks while hungry() is true, and the work is done once every thread
+// is waiting for a task and there are none left.
+//
+// Another thread can also pause() the workers, which park at their next node or
+// between tasks, so it can look at their state and the queues, e.g. to checkpoint.
+class TaskPool
+{
+public:
+  TaskPool(int num_threads) :
+    queues_(num_threads),
+    num_idle_(0),
+    num_queued_(0),
+    pause_requested_(false),
+    num_parked_(0),
+    num_exited_(0),
+    done_(false)
+  {
+  }
+
+  void add(int thread, const SearchTask& task)
+  {
+    {
+      lock_guard<mutex> lock(queues_[thread].mtx);
+      queues_[thread].tasks.push_back(task);
+    }
+    // Count the task under mtx_ so a thread that's about to wait can't miss it.
+    lock_guard<mutex> lock(mtx_);
+    ++num_queued_;
+    idle_cv_.notify_one();
+  }
+
+  // Blocks until there's a task to run, or returns false if all the work is done.
+  bool next(int thread, SearchTask* task)
+  {
+    while (true) {
+      if (pauseRequested())
+        park();
+      if (take(thread, task))
+        return true;
+
+      unique_lock<mutex> lock(mtx_);
+      if (num_queued_ > 0)
+        continue;
+      ++num_idle_;
+      while (true) {
+        if (num_idle_ == (int)queues_.size() && !done_) {
+          done_ = true;
+          idle_cv_.notify_all();
+        }
+        if (done_) {
+          ++num_exited_;
+          pause_cv_.notify_all();
+          return false;
+        }
+        if (num_queued_ > 0)
+          break;
+        if (pause_requested_)
+          parkLocked(lock);
+        else
+          idle_cv_.wait(lock);
+      }
+      --num_idle_;
+    }
+  }
+
+  // True if some thread is waiting for work that isn't already queued.
+  // Cheap enough to call on every node.
+  bool hungry() const
+  {
+    return num_idle_.load(memory_order_relaxed) > num_queued_.load(memory_order_relaxed);
+  }
+
+  // Also cheap enough to call on every node.  Workers call park() when it's true.
+  bool pauseRequested() const { return pause_requested_.load(memory_order_relaxed); }
+
+  void park()
+  {
+    unique_lock<mutex> lock(mtx_);
+    if (pause_requested_)
+      parkLocked(lock);
+  }
+  
+  // Returns once every worker is parked or has finished.
+  void pause()
+  {
+    unique_lock<mutex> lock(mtx_);
+    pause_requested_ = true;
+    idle_cv_.notify_all();
+    pause_cv_.wait(lock, [this]() { return num_parked_ + num_exited_ == (int)queues_.size(); });
+  }
+
+  void resume()
+  {
+    lock_guard<mutex> lock(mtx_);
+    pause_requested_ = false;
+    resume_cv_.notify_all();
+  }
+
+  // Returns true if every worker finished within the timeout.
+  bool waitUntilDone(chrono::duration<double> timeout)
+  {
+    unique_lock<mutex> lock(mtx_);
+    return pause_cv_.wait_for(lock, timeout, [this]() { return num_exited_ == (int)queues_.size(); });
+  }
+
+  // Only safe to call while paused.
+  vector<SearchTask> queuedTasks() const
+  {
+    vector<SearchTask> tasks;
+    for (size_t i = 0; i < queues_.size(); ++i)
+      tasks.insert(tasks.end(), queues_[i].tasks.begin(), queues_[i].tasks.end());
+    return tasks;
+  }
+  
+private:
+  struct Queue
+  {
+    mutex mtx;
+    deque<SearchTask> tasks;
+  };
+  deque<Queue> queues_;  // deque because Queue isn't movable.
+  mutex mtx_;
+  condition_variable idle_cv_;  // Idle workers wait on this for tasks.
+  condition_variable pause_cv_;  // pause() and waitUntilDone() wait on this.
+  condition_variable resume_cv_;  // Parked workers wait on this.
+  atomic<int> num_idle_;
+  atomic<int> num_queued_;
+  atomic<bool> pause_requested_;
+  int num_parked_;
+  int num_exited_;
+  bool done_;
+
+  bool take(int thread, SearchTask* task)
+  {
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      Queue& queue = queues_[(thread + i) % queues_.size()];
+      lock_guard<mutex> lock(queue.mtx);
+      if (queue.tasks.empty())
+        continue;
+      if (i == 0) {
+        *task = queue.tasks.back();
+        queue.tasks.pop_back();
+      }
+      else {
+        *task = queue.tasks.front();
+        queue.tasks.pop_front();
+      }
+      --num_queued_;
+      return true;
+    }
+    return false;
+  }
+
+  void parkLocked(unique_lock<mutex>& lock)
+  {
+    ++num_parked_;
+    pause_cv_.notify_all();
+    resume_cv_.wait(lock, [this]() { return !pause_requested_; });
+    --num_parked_;
+  }
+};
+
+// W is the number of 64-bit words needed to hold a set of digits in this base.
+// Heuristic, Involution and Verbose are template parameters rather than members so that the
+// checks on them in the node loop are resolved at compile time, and an ordinary search doesn't
+// carry any of the verbose printing at all.  Involution only builds prefixes that are
+// involutions (see expand()), which is a kind of heuristic search.
+template<typename Tracker, int W, bool Heuristic, bool Involution = false, bool Verbose = false>
 class TreeSearch
 {
+  static_assert(Heuristic || !Involution, "Involution search is heuristic.");
+
 public:  
-  TreeSearch(uint16_t base, bool heuristic, int max_symmetry_violation, bool verbose) :
+  TreeSearch(uint16_t base, int max_symmetry_violation, bool print_solutions = true) :
     base_(base),
-    heuristic_(heuristic),
     max_symmetry_violation_(max_symmetry_violation),
-    verbose_(verbose),
-    value_(0),
-    num_evals_(0)
-  {
-    mat_ = MatrixXi::Zero(base_, base_);    
-    used_.resize(base, false);
-
-    // Fill in place_values_ and check for overflow in them.
-    // This overflow checking is superseded by using boost::multiprecision::checked_uint*_t,
-    // but we'll keep them here anyway...
-    bool overflow = false;
-    place_values_.resize(base_);
-    for (size_t i = 0; i < place_values_.size(); ++i) {
-      place_values_[i] = ipow(base_, place_values_.size() - i - 1);
-      if (i > 0 && place_values_[i] > place_values_[i-1])
-        overflow = true;
-    }
-
-    if (overflow) {
-      cout << "Overflow detected." << endl;
-      cout << "Place values: " << place_values_ << endl;
-      assert(false);
+    print_solutions_(print_solutions),
+    tracker_(base),
+    place_residues_(base),
+    num_evals_(0),
+    next_node_id_(1),
+    split_depth_(numeric_limits<size_t>::max()),
+    pool_(NULL),
+    thread_(0),
+    task_depth_(0)
+  {
+    // In heuristic search, we only try alternating odd / even sequences.
+    // We know zero is always the last digit, so it's never a candidate.
+    //
+    // Both kinds of search also use the fact that the digit in position p must have the same
+    // gcd with the base as p does.  That's because for any g dividing the base, the prefix
+    // ending at a position divisible by g must be divisible by g, and since g divides the base
+    // that means its last digit is too.  There are base/g - 1 such positions before the last
+    // one, and exactly base/g - 1 nonzero digits divisible by g, so those digits are used up by
+    // those positions and can't go anywhere else.  E.g. in base 10, positions 2, 4, 6 and 8 hold
+    // 2, 4, 6 and 8 in some order, position 5 holds 5, and the rest hold 1, 3, 7 and 9.
+    allowed_.resize(base_ + 1);
+    for (size_t pos = 1; pos <= base_; ++pos) {
+      for (uint16_t digit = 1; digit < base_; ++digit)
+        if ((!Heuristic || digit % 2 == pos % 2) && gcd(digit, base_) == gcd(pos, base_))
+          allowed_[pos].insert(digit);
+    }
+
+    // not_below_[p] is the digits from p up.
+    not_below_.resize(base_);
+    for (uint16_t pos = 1; pos < base_; ++pos)
+      not_below_[pos] = DigitSet<W>::range(pos, base_);
+
+    // progressions_[p][r] is the nonzero digits congruent to r mod p.
+    progressions_.resize(base_);
+    for (uint16_t pos = 1; pos < base_; ++pos) {
+      progressions_[pos].resize(pos);
+      for (uint16_t digit = 1; digit < base_; ++digit)
+        progressions_[pos][digit % pos].insert(digit);
+    }
+
+    digits_.reserve(base_);
+    row_positions_.resize(base_ + 1, 0);
+    violations_.resize(base_ + 1, 0);
+    path_violations_.resize(base_ + 1, 0);
+    node_ids_.resize(base_, 0);
+    if (Heuristic)
+      evals_by_threshold_.resize(max(max_symmetry_violation_, 0) + 1, 0);
+    digit_sums_.resize(base_ + 1, 0);
+    alternating_sums_.resize(base_ + 1, 0);
+
+    // Most positions can be checked with a cheap rule.  For the rest, ask the tracker.
+    rules_.resize(base_ + 1);
+    trailing_digits_.resize(base_ + 1);
+    for (uint16_t pos = 1; pos <= base_; ++pos) {
+      rules_[pos] = divisibilityRule(base_, pos);
+      trailing_digits_[pos] = trailingDigitsFor(base_, pos);
+    }
+    pending_.resize(base_);
+
+    // digits2Val() builds full values for printing, so they have to fit in BigUInt.
+    assert(fitsBase<BigUInt>(base_));
+  }
+
+  // Add a new digit to the end of our number and update everything
+  // associated with that.
+  void push(uint16_t digit)
+  {
+    digits_.push_back(digit);
+    used_.insert(digit);
+    tracker_.push(digit);
+
+    // Zero is a special case that is only tried as the last digit.
+    assert(digit != 0 || (uint16_t)digits_.size() == base_);
+
+    // Growing the leading block of the matrix form by one adds a new row and column to it.
+    // The new column has its one in the new digit's row, and the new row has its one in
+    // the column of whichever position holds digit n, if any.  Each is a violation unless
+    // they're each other's transpose.
+    size_t n = digits_.size();
+    uint16_t row = (digit == 0 ? base_ : digit);
+    uint16_t col = row_positions_[n];
+    int violation = violations_[n - 1] + (row < n) + (col != 0);
+    if (row < n && col == row)
+      violation -= 2;
+    violations_[n] = violation;
+    row_positions_[row] = n;
+
+    // We only got here if every node above this one was within the max symmetry violation,
+    // so this node would be visited by a search with any threshold from the biggest of theirs up.
+    if (Heuristic) {
+      int path_violation = path_violations_[n - 1];
+      ++evals_by_threshold_[path_violation];
+      path_violations_[n] = max(path_violation, violation);
+    }
+
+    digit_sums_[n] = digit_sums_[n - 1] + digit;
+    alternating_sums_[n] = digit - alternating_sums_[n - 1];
+    
+    num_evals_++;
+
+    if (Verbose) {
+      cout << "--------------" << endl;
+      cout << "Evaluating..." << endl;
+      cout << "--------------" << endl;
+      cout << "digits_ " << digits_ << endl;
+      cout << "used_ " << used_ << endl;
+      cout << "value " << digits2Val(digits_) << endl;
+      cout << "matrix " << endl << matrix() << endl;
+      cout << "symmetry violation " << violations_[digits_.size()] << endl;
+      cin.get();
+    }
+  }
+
+  // Pop the last digit off the end of our number and undo all the updates
+  // we made in push().
+  void pop()
+  {
+    uint16_t digit = digits_.back();
+    row_positions_[digit == 0 ? base_ : digit] = 0;
+    
+    digits_.resize(digits_.size() - 1);
+    used_.erase(digit);
+    tracker_.pop();
+  }
+  
+  // Search the whole tree below the current prefix.
+  uint64_t search()
+  {
+    if (expand())
+      run();
+    return num_evals_;
+  }
+
+  // Carry on searching from wherever we are, without recursion: all the state lives in
+  // per-depth arrays (pending_ for the digits left to try, and the tracker, violations_
+  // and the digit sums for what push() computed), so each step just moves up or down a
+  // level.  Stops once the pending digits at every level from task_depth_ down have been
+  // tried, or early, with everything left intact, once the num evals reaches max_evals.
+  // frontier() gives the work that's left after stopping early, and calling run() again
+  // carries on from there.  Returns true if there's nothing left.
+  bool run(uint64_t max_evals = numeric_limits<uint64_t>::max())
+  {
+    while (true) {
+      size_t depth = digits_.size();
+      if (pending_[depth].empty()) {
+        if (depth == task_depth_)
+          return true;
+        // Done with this node, so go back up to its parent.
+        popAndCheckPool();
+        continue;
+      }
+      if (num_evals_ >= max_evals)
+        return false;
+
+      // The pending digits all pass the main divisibility constraint, so if we're doing an
+      // exhaustive search, continue searching down this branch.
+      // If we're doing a heuristic search, check for symmetry first.
+      push(pending_[depth].popFront());
+      bool symmetric_enough = !Heuristic || violations_[digits_.size()] <= max_symmetry_violation_;
+      if (symmetric_enough && expand())
+        continue;
+      if (!symmetric_enough)
+        recordCut();
+      popAndCheckPool();
+    }
+  }
+
+  // The recursive version of search(), single-threaded.  Kept as a reference for the
+  // iterative one, which visits the same nodes in the same order.
+  uint64_t searchRecursive()
+  {
+    if (!expand())
+      return num_evals_;
+
+    size_t depth = digits_.size();
+    while (!pending_[depth].empty()) {
+      push(pending_[depth].popFront());
+      if (!Heuristic || violations_[digits_.size()] <= max_symmetry_violation_)
+        searchRecursive();
+      pop();
+    }
+    return num_evals_;
+  }
+
+  // Deal with the node we just pushed.  If it has children, put the ones to try in
+  // pending_ and return true.  Otherwise, handle it here and return false.
+  bool expand()
+  {
+    // When splitting the tree into tasks, hand back the prefix rather than searching below it.
+    if (digits_.size() == split_depth_) {
+      SearchTask task;
+      task.prefix = digits_;
+      tasks_.push_back(task);
+      return false;
+    }
+    
+    // If there's only one digit left, we know it has to be zero.
+    if (digits_.size() == (size_t)base_ - 1) {
+      push(0);
+
+      if (divides(digits_.size())) {
+        // Double check the solution from scratch, independently of the tracker.
+        assert(violations_[base_] == symmetryViolation(digits_));
+        assert(isSolution(digits_));
+        solutions_.push_back(digits_);
+        if (print_solutions_)
+          printSolution(digits_);
+      }
+      
+      pop();
+      return false;
+    }
+
+    // Otherwise, try adding digits that haven't been used yet, and recursively search if they work.
+    // Rather than pushing each one to see whether the new prefix is divisible by its length,
+    // solve for the ones that are: with the prefix P, the digit x in position pos works exactly
+    // when x = -P * base mod pos.
+    size_t pos = digits_.size() + 1;
+    uint64_t needed = nextDigitResidue(place_residues_, pos, residue(pos));
+    DigitSet<W> candidates = (allowed_[pos] - used_) & progressions_[pos][needed];
+
+    // When only building involutions, position p holds digit d exactly when position d holds
+    // digit p.  So if an earlier position holds digit pos, this position has to hold that
+    // position's index.  Otherwise it needs a digit of at least pos, since a smaller one
+    // would have put digit pos in an earlier position.  These are exactly the children that
+    // keep the symmetry violation at zero.
+    if (Involution) {
+      uint16_t partner = row_positions_[pos];
+      if (partner != 0) {
+        bool allowed = candidates.contains(partner);
+        candidates = DigitSet<W>();
+        if (allowed)
+          candidates.insert(partner);
+      }
+      else
+        candidates = candidates & not_below_[pos];
+    }
+
+    // Forward checking: drop the digits that would leave nothing to put in the position after.
+    // The last position always takes zero, so there's nothing to check before it.
+    if (pos + 1 < base_) {
+      uint64_t next_residue = residue(pos + 1);
+      DigitSet<W> next_unused = allowed_[pos + 1] - used_;
+      candidates = forwardCheck(candidates, next_unused, progressions_[pos + 1],
+                                place_residues_, pos, next_residue);
+    }
+
+    pending_[digits_.size()] = candidates;
+    node_ids_[digits_.size()] = next_node_id_++;
+    return true;
+  }
+
+  // Search the subtree below a task's prefix.
+  uint64_t search(const SearchTask& task)
+  {
+    if (start(task))
+      run();
+    finish();
+    return num_evals_;
+  }
+
+  // Get ready to run() a task: rebuild its prefix, and fill in the digits to try after it.
+  // The pushes that rebuild the prefix aren't counted, since they were counted when the
+  // task was made.  Returns false if there's nothing to run.
+  bool start(const SearchTask& task)
+  {
+    assert(digits_.empty());
+    for (size_t i = 0; i < task.prefix.size(); ++i)
+      push(task.prefix[i]);
+    num_evals_ -= task.prefix.size();
+    if (Heuristic)
+      for (size_t i = 0; i < task.prefix.size(); ++i)
+        --evals_by_threshold_[path_violations_[i]];
+    task_depth_ = task.prefix.size();
+
+    if (task.candidates.empty())
+      return expand();
+    pending_[digits_.size()] = DigitSet<W>();
+    for (size_t i = 0; i < task.candidates.size(); ++i)
+      pending_[digits_.size()].insert(task.candidates[i]);
+    return true;
+  }
+
+  // Go back to the empty prefix, ready for the next task.
+  void finish()
+  {
+    while (!digits_.empty())
+      pop();
+  }
+
+  // Split the tree one level at a time until there are at least min_tasks subtrees,
+  // counting the nodes visited along the way.  Searching every returned task and adding
+  // up the num evals gives the same answer as search().
+  vector<SearchTask> split(size_t min_tasks)
+  {
+    vector<SearchTask> tasks(1);
+    for (size_t depth = 1; depth < base_ && tasks.size() < min_tasks; ++depth) {
+      split_depth_ = depth;
+      for (size_t i = 0; i < tasks.size(); ++i)
+        search(tasks[i]);
+      tasks.swap(tasks_);
+      tasks_.clear();
+    }
+    split_depth_ = numeric_limits<size_t>::max();
+    return tasks;
+  }
+
+  // The work left in the current task, as tasks: the untried digits at each level of the
+  // current prefix.  Searching all of these finishes the task.
+  vector<SearchTask> frontier() const
+  {
+    vector<SearchTask> tasks;
+    for (size_t depth = task_depth_; depth <= digits_.size(); ++depth) {
+      if (pending_[depth].empty())
+        continue;
+      SearchTask task;
+      task.prefix.assign(digits_.begin(), digits_.begin() + depth);
+      task.candidates = pending_[depth].digits();
+      tasks.push_back(task);
+    }
+    return tasks;
+  }
+
+  // Start remembering the nodes that the symmetry check cuts off, for searchCuts(), as long as
+  // their symmetry violation is at most max_violation.
+  void recordCuts(int max_violation)
+  {
+    cuts_.resize(max_violation + 1);
+    cut_node_ids_.assign(max_violation + 1, 0);
+  }
+
+  // Raise the max symmetry violation, e.g. to carry on with searchCuts().
+  void setMaxSymmetryViolation(int max_symmetry_violation)
+  {
+    max_symmetry_violation_ = max_symmetry_violation;
+    if (Heuristic)
+      evals_by_threshold_.resize(max(max_symmetry_violation_, (int)evals_by_threshold_.size() - 1) + 1, 0);
+  }
+
+  // Search below the nodes that were cut off with exactly this symmetry violation, which the max
+  // symmetry violation now has to allow.  Together with the search that cut them off, this visits
+  // the same nodes as searching from scratch with the new max.  The cut nodes themselves were
+  // counted when they were cut, so they aren't counted again here.
+  uint64_t searchCuts(int violation)
+  {
+    assert(violation <= max_symmetry_violation_);
+    vector<SearchTask> cuts;
+    cuts.swap(cuts_[violation]);
+    for (size_t i = 0; i < cuts.size(); ++i) {
+      start(cuts[i]);
+      num_evals_ -= cuts[i].candidates.size();
+      if (Heuristic)
+        evals_by_threshold_[path_violations_[digits_.size()]] -= cuts[i].candidates.size();
+      run();
+      finish();
+    }
+    return num_evals_;
+  }
+
+  // One of Knuth's random probes ("Estimating the Efficiency of Backtrack Programs", 1975):
+  // walk down from the root, picking one child to carry on below at each step, and return
+  // the num evals search() would do if every node at each depth had as many children as the
+  // ones along the way.  Over many probes, that averages out to the real num evals.
+  // Each node's children are all pushed and counted, but only the ones within the max symmetry
+  // violation are carried on below, so those are the ones the probe picks from, uniformly.
+  // With importance sampling, it picks them in proportion to how many children they have in
+  // turn, and weights by one over that chance instead, so it never wastes a probe on a dead end.
+  double probe(mt19937_64* rng, bool importance)
+  {
+    assert(digits_.empty());
+    double weight = 1;
+    double estimate = 0;
+    vector<uint16_t> children;
+    vector<double> scores;
+    bool internal = expand();
+    while (internal) {
+      DigitSet<W> pending = pending_[digits_.size()];
+      estimate += weight * pending.size();
+
+      children.clear();
+      scores.clear();
+      double total = 0;
+      while (!pending.empty()) {
+        uint16_t digit = pending.popFront();
+        if (!Heuristic && !importance) {
+          children.push_back(digit);
+          scores.push_back(1);
+          total += 1;
+          continue;
+        }
+        push(digit);
+        if (!Heuristic || violations_[digits_.size()] <= max_symmetry_violation_) {
+          double score = 1;
+          if (importance && digits_.size() < (size_t)base_ - 1)
+            score = expand() ? pending_[digits_.size()].size() : 0;
+          if (score > 0) {
+            children.push_back(digit);
+            scores.push_back(score);
+            total += score;
+          }
+        }
+        pop();
+      }
+      if (children.empty())
+        break;
+
+      double pick = uniform_real_distribution<double>(0, total)(*rng);
+      size_t i = 0;
+      while (i + 1 < children.size() && pick >= scores[i]) {
+        pick -= scores[i];
+        ++i;
+      }
+      weight *= total / scores[i];
+      push(children[i]);
+      // The only child of a node with one digit left is the leaf push of zero.  Counting it
+      // here rather than calling expand() keeps the probes from piling up solutions.
+      if (digits_.size() == (size_t)base_ - 1) {
+        estimate += weight;
+        break;
+      }
+      internal = expand();
+    }
+    finish();
+    return estimate;
+  }
+
+  // Hand back every prefix of this length, via takeTasks(), rather than searching below it.
+  void setSplitDepth(size_t depth) { split_depth_ = depth; }
+
+  // The prefixes collected at the split depth so far, which are forgotten.
+  vector<SearchTask> takeTasks()
+  {
+    vector<SearchTask> tasks;
+    tasks.swap(tasks_);
+    return tasks;
+  }
+
+  // The digits we'd consider for position pos, and the nonzero digits in each residue class mod pos.
+  const DigitSet<W>& allowed(size_t pos) const { return allowed_[pos]; }
+  const vector<DigitSet<W>>& progressions(size_t pos) const { return progressions_[pos]; }
+
+  // Have search() give work to pool whenever some thread is idle, and park when asked to.
+  void setPool(TaskPool* pool, int thread)
+  {
+    pool_ = pool;
+    thread_ = thread;
+  }
+
+  void printSolution(const std::vector<uint16_t>& digits)
+  {
+    int violation = symmetryViolation(digits);
+    cout << "Solution: " << digits << " (" << digits2Val(digits) << ")"
+         << " [Symmetric: " << (violation == 0) << "]"
+         << " [Symmetry violation: " << violation << "]" << endl;
+    cout << digits2Matrix(digits) << endl;
+  }
+
+  uint64_t numEvals() const { return num_evals_; }
+  // In a heuristic search, element t is how many of the num evals a search with a max symmetry
+  // violation of t would have done but one with t - 1 wouldn't.  Empty for exhaustive search.
+  const vector<uint64_t>& evalsByThreshold() const { return evals_by_threshold_; }
+  const vector<vector<uint16_t>>& solutions() const { return solutions_; }
+    
+private:
+  uint16_t base_;
+  int max_symmetry_violation_;
+  bool print_solutions_;
+  Tracker tracker_;
+  ResidueTable place_residues_;
+  vector<uint16_t> digits_;  // The number, in order of most significant to least significant
+  DigitSet<W> used_;  // The digits that appear in the number so far.
+  vector<DigitSet<W>> allowed_;  // allowed_[p] is the digits we'd consider for position p.
+  vector<vector<DigitSet<W>>> progressions_;
+  vector<DigitSet<W>> not_below_;
+  uint64_t num_evals_;
+  // Together with digits_, which maps positions to digits, this is the matrix form of
+  // the number so far (see digits2Matrix()) as a pair of arrays.
+  // row_positions_[r] is the position (counting from 1) of the digit whose one is in row r,
+  // also counting from 1, or zero if that digit hasn't been used.  The digit for row r is r,
+  // except for zero which is in row base_.
+  vector<uint16_t> row_positions_;
+  // violations_[i] is the symmetry violation of the leading i x i block of the matrix form.
+  // Kept up to date in push() rather than scanning the block at every node.
+  vector<int> violations_;
+  // path_violations_[i] is the biggest of violations_[1] to violations_[i].
+  vector<int> path_violations_;
+  vector<uint64_t> evals_by_threshold_;
+  // node_ids_[i] identifies the node at depth i on the current path, among all nodes expand()
+  // has filled in pending_ for.  That's how recordCut() tells whether two cuts are siblings.
+  vector<uint64_t> node_ids_;
+  uint64_t next_node_id_;
+  // cuts_[v] is the nodes the symmetry check cut off with violation v, as tasks.
+  // Only kept if recordCuts() was called, and only up to the violation it was given.
+  vector<vector<SearchTask>> cuts_;
+  vector<uint64_t> cut_node_ids_;  // cut_node_ids_[v] is the id of the parent of cuts_[v].back().
+  // digit_sums_[i] and alternating_sums_[i] are the sum and alternating sum of the first i
+  // digits, the latter with a plus sign on the last one.  See DivisibilityRule.
+  vector<uint32_t> digit_sums_;
+  vector<int32_t> alternating_sums_;
+  vector<DivisibilityRule> rules_;  // rules_[p] is how we check divisibility by position p.
+  vector<uint16_t> trailing_digits_;  // trailing_digits_[p] is trailingDigitsFor(base_, p).
+  vector<vector<uint16_t>> solutions_;
+  // Used by split().
+  size_t split_depth_;
+  vector<SearchTask> tasks_;
+  // pending_[i] holds the digits still to be tried in position i+1, below the current prefix.
+  // Only entries up to the current depth are live.
+  vector<DigitSet<W>> pending_;
+  TaskPool* pool_;
+  int thread_;
+  size_t task_depth_;  // Depth of the prefix of the task we're working on.
+
+  // The number so far mod position k, by its cheap divisibility rule if it has one.
+  // k must be at least the current number of digits.
+  uint64_t residue(uint16_t k) const
+  {
+    const FastMod& divisor = place_residues_.divisor(k);
+    size_t n = digits_.size();
+    switch (rules_[k]) {
+    case DivisibilityRule::DigitSum:
+      return divisor.mod(digit_sums_[n]);
+    case DivisibilityRule::AlternatingSum: {
+      int32_t sum = alternating_sums_[n];
+      if (sum >= 0)
+        return divisor.mod(sum);
+      uint64_t r = divisor.mod(-sum);
+      return r == 0 ? 0 : k - r;
+    }
+    case DivisibilityRule::TrailingDigits: {
+      uint32_t sum = 0;
+      for (size_t j = 0; j < trailing_digits_[k] && j < n; ++j)
+        sum += digits_[n - j - 1] * place_residues_.placeResidue(k, j);
+      return divisor.mod(sum);
+    }
+    default:
+      return tracker_.residue(k);
+    }
+  }
+
+  // Whether position k divides the number so far, with the same rules and restrictions as
+  // residue(), but testing divisibility directly rather than taking the remainder.
+  bool divides(uint16_t k) const
+  {
+    const FastMod& divisor = place_residues_.divisor(k);
+    size_t n = digits_.size();
+    switch (rules_[k]) {
+    case DivisibilityRule::DigitSum:
+      return divisor.divides(digit_sums_[n]);
+    case DivisibilityRule::AlternatingSum: {
+      int32_t sum = alternating_sums_[n];
+      return divisor.divides(sum >= 0 ? sum : -sum);
+    }
+    case DivisibilityRule::TrailingDigits: {
+      uint32_t sum = 0;
+      for (size_t j = 0; j < trailing_digits_[k] && j < n; ++j)
+        sum += digits_[n - j - 1] * place_residues_.placeResidue(k, j);
+      return divisor.divides(sum);
+    }
+    default:
+      return tracker_.divides(k);
+    }
+  }
+
+  // The full base_ x base_ matrix form of the number so far, for printing.  Unlike
+  // digits2Matrix(digits_), this keeps the digits that are bigger than the prefix is long.
+  MatrixXi matrix() const
+  {
+    MatrixXi m = MatrixXi::Zero(base_, base_);
+    for (uint16_t row = 1; row <= base_; ++row)
+      if (row_positions_[row] != 0)
+        m(row - 1, row_positions_[row] - 1) = 1;
+    return m;
+  }
+
+  // Remember the node we just pushed, which the symmetry check cut off.  Cut siblings with
+  // the same violation share a task: their parent's prefix, with them as the candidates.
+  void recordCut()
+  {
+    int violation = violations_[digits_.size()];
+    if (violation >= (int)cuts_.size())
+      return;
+    size_t parent_depth = digits_.size() - 1;
+    vector<SearchTask>& cuts = cuts_[violation];
+    if (cuts.empty() || cut_node_ids_[violation] != node_ids_[parent_depth]) {
+      cuts.push_back(SearchTask());
+      cuts.back().prefix.assign(digits_.begin(), digits_.end() - 1);
+      cut_node_ids_[violation] = node_ids_[parent_depth];
+    }
+    cuts.back().candidates.push_back(digits_.back());
+  }
+
+  // Between nodes is where we give work to other threads or pause for a checkpoint.
+  // The pending digits live in pending_ rather than on the stack so that donate() can give
+  // some of them away.
+  void popAndCheckPool()
+  {
+    pop();
+    if (pool_) {
+      if (pool_->hungry())
+        donate();
+      if (pool_->pauseRequested())
+        pool_->park();
+    }
+  }
+
+  // Give half of the remaining digits at the shallowest level that has any left
+  // to the pool, as a new task.  Shallow levels have the biggest subtrees, so
+  // idle threads get a big chunk of work, and whatever is left keeps getting
+  // halved as long as there are idle threads.
+  void donate()
+  {
+    for (size_t depth = task_depth_; depth <= digits_.size(); ++depth) {
+      if (pending_[depth].empty())
+        continue;
+
+      vector<uint16_t> digits = pending_[depth].digits();
+      SearchTask task;
+      task.prefix.assign(digits_.begin(), digits_.begin() + depth);
+      task.candidates.assign(digits.begin() + digits.size() / 2, digits.end());
+      for (size_t i = 0; i < task.candidates.size(); ++i)
+        pending_[depth].erase(task.candidates[i]);
+      pool_->add(thread_, task);
+      return;
+    }
+  }
+  
+  BigUInt digits2Val(const std::vector<uint16_t>& digits)
+  {
+    BigUInt val = 0;
+    for (size_t i = 0; i < digits.size(); ++i)
+      val = val * base_ + digits[i];
+
+    return val;
+  }
+
+  // Check every prefix of digits for divisibility from scratch, with the place value residue table.
+  bool isSolution(const std::vector<uint16_t>& digits)
+  {
+    return place_residues_.prefixesDivisible(digits.data(), digits.size());
+  }
+
+};
+
+// Mixes x into the hash h: boost's hash_combine step, then splitmix64's finalizer.
+uint64_t mixHash(uint64_t h, uint64_t x)
+{
+  h ^= x + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+// Exhaustive search that meets in the middle.  With the prefix P of the first split_depth
+// digits, the prefix ending at any later position k is P * base^(k - split_depth) plus the
+// value S of the digits in between, so all a prefix has to say about how it can be finished
+// is which digits it used and P * base^(k - split_depth) mod k for each k.  Prefixes with the
+// same of both are the same state, and the suffixes that finish that state are the ones
+// with S = -P * base^(k - split_depth) mod k at every k.
+//
+// The prefix side is the ordinary tree search, stopped at the split depth.  Its states are
+// indexed in hash tables as a trie, and the suffix side searches the unused digits of each
+// distinct set of used ones, only trying the digits that give a residue some state wants.
+// So every suffix node is shared by all the prefixes that agree on it, rather than being
+// visited once per prefix.  The prefixes are joined in batches of about batch_evals evals,
+// so the tables fit in memory however big the tree is.  Small batches, which keep them in
+// cache, turn out to be fastest: in practice, prefixes hardly ever share a state, so there's
+// little merging to lose by splitting them up.
+template<typename Tracker, int W>
+class MeetInTheMiddle
+{
+public:
+  MeetInTheMiddle(uint16_t base, size_t split_depth, bool print_solutions = true,
+                  uint64_t batch_evals = 1 << 13) :
+    base_(base),
+    split_depth_(split_depth),
+    print_solutions_(print_solutions),
+    batch_evals_(batch_evals),
+    prefix_search_(base, 0, print_solutions),
+    place_residues_(base),
+    num_suffix_evals_(0),
+    num_prefixes_(0),
+    num_states_(0)
+  {
+    // The suffix has at least one digit before the final zero.
+    assert(split_depth_ >= 1 && split_depth_ + 2 <= base_);
+    wanted_.resize(base_ - 1 - split_depth_);
+  }
+
+  uint64_t search()
+  {
+    prefix_search_.setSplitDepth(split_depth_);
+    bool done = !prefix_search_.start(SearchTask());
+    while (!done) {
+      done = prefix_search_.run(prefix_search_.numEvals() + batch_evals_);
+      join(prefix_search_.takeTasks());
+    }
+    prefix_search_.finish();
+    return numEvals();
+  }
+
+  // Nodes visited on both sides.  A suffix node counts once however many prefixes it could finish.
+  uint64_t numEvals() const { return prefix_search_.numEvals() + num_suffix_evals_; }
+  uint64_t numPrefixes() const { return num_prefixes_; }
+  uint64_t numStates() const { return num_states_; }
+  const vector<vector<uint16_t>>& solutions() const { return solutions_; }
+
+private:
+  uint16_t base_;
+  size_t split_depth_;
+  bool print_solutions_;
+  uint64_t batch_evals_;
+  TreeSearch<Tracker, W, false> prefix_search_;
+  ResidueTable place_residues_;
+  uint64_t num_suffix_evals_;
+  uint64_t num_prefixes_;
+  uint64_t num_states_;
+  vector<vector<uint16_t>> solutions_;
+
+  // The current batch.  The key for a state's first j residues is the hash of them, starting
+  // from the hash of its unused digits.  wanted_[j] maps that to the residues in position
+  // split_depth_ + j + 1 of the states that start that way, and states_ maps the key for
+  // all of them to the prefixes in prefixes_ that are in that state.
+  vector<SearchTask> prefixes_;
+  vector<unordered_map<uint64_t, DigitSet<W>>> wanted_;
+  unordered_map<uint64_t, vector<size_t>> states_;
+  vector<uint16_t> suffix_;
+
+  uint64_t hashDigits(const DigitSet<W>& digits) const
+  {
+    uint64_t h = 0;
+    for (int i = 0; i < W; ++i)
+      h = mixHash(h, digits.words()[i]);
+    return h;
+  }
+
+  void join(vector<SearchTask> prefixes)
+  {
+    prefixes_.swap(prefixes);
+    num_prefixes_ += prefixes_.size();
+
+    // Index the prefixes by state, and group them by the digits they leave for the suffix.
+    map<DigitSet<W>, uint64_t> unused_digits;
+    DigitSet<W> all = DigitSet<W>::range(1, base_);
+    for (size_t i = 0; i < prefixes_.size(); ++i) {
+      const vector<uint16_t>& prefix = prefixes_[i].prefix;
+      DigitSet<W> unused = all;
+      for (size_t j = 0; j < prefix.size(); ++j)
+        unused.erase(prefix[j]);
+      uint64_t h = hashDigits(unused);
+      unused_digits[unused] = h;
+
+      for (size_t k = split_depth_ + 1; k < base_; ++k) {
+        uint32_t sum = 0;
+        for (size_t j = 0; j < split_depth_; ++j)
+          sum += prefix[j] * place_residues_.placeResidue(k, k - 1 - j);
+        uint64_t residue = place_residues_.divisor(k).mod(sum);
+        wanted_[k - split_depth_ - 1][h].insert(residue);
+        h = mixHash(h, residue);
+      }
+      vector<size_t>& state = states_[h];
+      if (state.empty())
+        ++num_states_;
+      state.push_back(i);
+    }
+
+    for (auto it = unused_digits.begin(); it != unused_digits.end(); ++it)
+      searchSuffixes(it->first, it->second);
+
+    prefixes_.clear();
+    for (size_t j = 0; j < wanted_.size(); ++j)
+      wanted_[j].clear();
+    states_.clear();
+  }
+
+  // Try the unused digits in the next position of the suffix that give some state in the
+  // batch the residue it wants there.  For the prefix residue t and the suffix S so far,
+  // that's the digits congruent to -(t + S * base) mod pos.
+  void searchSuffixes(const DigitSet<W>& unused, uint64_t h)
+  {
+    size_t pos = split_depth_ + suffix_.size() + 1;
+    auto wanted = wanted_[pos - split_depth_ - 1].find(h);
+    if (wanted == wanted_[pos - split_depth_ - 1].end())
+      return;
+    const FastMod& divisor = place_residues_.divisor(pos);
+    uint64_t shifted = divisor.mod(place_residues_.prefixResidue(suffix_.data(), suffix_.size(), pos) * base_);
+    DigitSet<W> unused_allowed = unused & prefix_search_.allowed(pos);
+
+    DigitSet<W> residues = wanted->second;
+    while (!residues.empty()) {
+      uint16_t residue = residues.popFront();
+      uint64_t sum = divisor.mod(residue + shifted);
+      DigitSet<W> candidates = unused_allowed & prefix_search_.progressions(pos)[sum == 0 ? 0 : pos - sum];
+      uint64_t child = mixHash(h, residue);
+      while (!candidates.empty()) {
+        uint16_t digit = candidates.popFront();
+        ++num_suffix_evals_;
+        suffix_.push_back(digit);
+        if (pos + 1 == base_) {
+          auto state = states_.find(child);
+          if (state != states_.end())
+            finishPrefixes(state->second);
+        }
+        else {
+          DigitSet<W> rest = unused;
+          rest.erase(digit);
+          searchSuffixes(rest, child);
+        }
+        suffix_.pop_back();
+      }
+    }
+  }
+
+  // The suffix finishes these prefixes, with a zero on the end.  Check each one from scratch,
+  // which also weeds out hash collisions.
+  void finishPrefixes(const vector<size_t>& state)
+  {
+    for (size_t i = 0; i < state.size(); ++i) {
+      vector<uint16_t> digits = prefixes_[state[i]].prefix;
+      bool disjoint = true;
+      for (size_t j = 0; j < suffix_.size(); ++j)
+        disjoint = disjoint && find(digits.begin(), digits.end(), suffix_[j]) == digits.end();
+      if (!disjoint)
+        continue;
+      digits.insert(digits.end(), suffix_.begin(), suffix_.end());
+      digits.push_back(0);
+      if (!place_residues_.prefixesDivisible(digits.data(), digits.size()))
+        continue;
+      solutions_.push_back(digits);
+      if (print_solutions_)
+        prefix_search_.printSolution(digits);
+    }
+  }
+};
+
+// Exhaustive search one position at a time, rather than depth first: the whole frontier of
+// prefixes of each length is held in flat arrays, one per field, and expanded into the next
+// length's with loops that run straight through them.  That way the checks stream through
+// memory instead of jumping around a recursion, and the number of prefixes of every length
+// comes for free.  It visits exactly the nodes TreeSearch does, so the sizes add up to its
+// num evals.
+//
+// Each prefix keeps its used digits, its residues mod a few combined moduli like
+// ResidueTracker's (but covering every position, so no other rules are needed), and, to
+// spell out the solutions at the end, its last digit and the index of its parent.
+// Only the chunks that cover positions still to come are kept.
+//
+// Given a spill directory, the frontier doesn't have to fit in memory.  Each length is
+// written there in chunks of whatever size fits the memory budget, and read back one at a
+// time to build the next, so the search only slows down to the speed of the disk.  The
+// parents and last digits go to one file per length, and a progress file records how far
+// along the chunks we are, so a search that gets killed can pick up from the last chunk.
+template<int W>
+class BreadthFirstSearch
+{
+public:
+  BreadthFirstSearch(uint16_t base, bool print_solutions = true, const string& spill_dir = "",
+                     uint64_t memory_budget = 0) :
+    base_(base),
+    print_solutions_(print_solutions),
+    spill_dir_(spill_dir),
+    tables_(base, 0, false),
+    place_residues_(base),
+    chunk_size_(numeric_limits<uint64_t>::max()),
+    num_chunks_written_(0),
+    max_chunks_written_(numeric_limits<uint64_t>::max())
+  {
+    groupModuli(base_, false, &moduli_, &chunk_of_);
+    for (size_t c = 0; c < moduli_.size(); ++c)
+      chunk_divisors_.push_back(FastMod(moduli_[c]));
+    level_sizes_.resize(base_ + 1, 0);
+    level_sizes_[0] = 1;
+    parents_.resize(base_);
+    last_digits_.resize(base_);
+
+    // Building the next length holds a chunk of prefixes, their children's digits, and a chunk
+    // of children, each with their used digits and at most all of the residues.  Much smaller
+    // chunks than the minimum would just mean a lot of files.
+    if (spilling())
+      chunk_size_ = max<uint64_t>(memory_budget / (3 * 8 * W + 2 * 8 * moduli_.size() + 9), 1 << 10);
+  }
+
+  // Search from the start, or with resume, from wherever the progress file in the spill
+  // directory says the last search got to.  Returns false if there's nothing to resume, or if
+  // stopped by stopAfterChunks().
+  bool search(bool resume = false)
+  {
+    Progress progress;
+    if (resume) {
+      if (!loadProgress(&progress))
+        return false;
+      // Forget whatever was written after the last chunk that was finished, and anything
+      // left of the length before, in case we were killed before deleting it.
+      if (progress.len > 0)
+        dropLevel(progress.len - 1, 0);
+      size_t len = progress.len + 1;
+      if (len < base_ && level_sizes_[len] > 0 &&
+          (truncate(pathFile(len, "parents").c_str(), level_sizes_[len] * sizeof(uint64_t)) != 0 ||
+           truncate(pathFile(len, "digits").c_str(), level_sizes_[len]) != 0))
+        return false;
+    }
+    else {
+      // The root: no digits, nothing used, and zero mod everything.
+      Frontier root;
+      for (int w = 0; w < W; ++w)
+        root.used[w].assign(1, 0);
+      root.residues.resize(moduli_.size());
+      for (size_t c = 0; c < moduli_.size(); ++c)
+        root.residues[c].assign(1, 0);
+      putChunk(0, 0, &root);
+      progress.len = 0;
+      progress.num_chunks = 1;
+      saveProgress(progress);
+    }
+
+    while (progress.len + 1 < base_) {
+      if (!expandLevel(&progress))
+        return false;
+      size_t done_len = progress.len;
+      size_t num_chunks = progress.num_chunks;
+      progress.len = done_len + 1;
+      progress.num_chunks = progress.num_output_chunks;
+      progress.chunks_done = 0;
+      progress.prefixes_done = 0;
+      progress.num_output_chunks = 0;
+      saveProgress(progress);
+      dropLevel(done_len, num_chunks);
+    }
+    dropLevel(base_ - 1, progress.num_chunks);
+
+    // The last digit is zero, and base divides anything ending in zero, so every prefix
+    // of length base - 1 is a solution.
+    level_sizes_[base_] = level_sizes_[base_ - 1];
+    for (uint64_t i = 0; i < level_sizes_[base_ - 1]; ++i) {
+      vector<uint16_t> digits(base_, 0);
+      uint64_t node = i;
+      for (size_t len = base_ - 1; len >= 1; --len) {
+        uint8_t digit = 0;
+        pathAt(len, node, &node, &digit);
+        digits[len - 1] = digit;
+      }
+      assert(place_residues_.prefixesDivisible(digits.data(), digits.size()));
+      solutions_.push_back(digits);
+      if (print_solutions_)
+        tables_.printSolution(digits);
+    }
+    return true;
+  }
+
+  uint64_t numEvals() const
+  {
+    uint64_t num_evals = 0;
+    for (size_t len = 1; len <= base_; ++len)
+      num_evals += level_sizes_[len];
+    return num_evals;
+  }
+
+  // Stop search() once it has written this many chunks of prefixes, without recording how far it
+  // got, as if it had been killed there.  For testing --resume.
+  void stopAfterChunks(uint64_t num_chunks) { max_chunks_written_ = num_chunks; }
+
+  // levelSizes()[n] is the number of prefixes of length n that pass every check.
+  const vector<uint64_t>& levelSizes() const { return level_sizes_; }
+  const vector<vector<uint16_t>>& solutions() const { return solutions_; }
+
+private:
+  // A chunk of the prefixes of one length.  used[w][i] is word w of the digits prefix i has
+  // used, and residues[c][i] is it mod moduli_[c], for the chunks c that are still needed.
+  struct Frontier
+  {
+    vector<uint64_t> used[W];
+    vector<vector<uint64_t>> residues;
+
+    uint64_t size() const { return used[0].size(); }
+  };
+
+  // How far along the search is: the chunks of prefixes of length len that have been expanded
+  // so far, and the chunks of their children that have been written.
+  struct Progress
+  {
+    size_t len = 0;
+    size_t num_chunks = 0;
+    size_t chunks_done = 0;
+    uint64_t prefixes_done = 0;
+    size_t num_output_chunks = 0;
+  };
+
+  uint16_t base_;
+  bool print_solutions_;
+  string spill_dir_;  // Empty if the frontier stays in memory.
+  TreeSearch<ResidueTracker, W, false> tables_;  // For the digit sets it uses, and printSolution().
+  ResidueTable place_residues_;
+  uint64_t chunk_size_;  // The most prefixes we make at a time.
+  uint64_t num_chunks_written_;
+  uint64_t max_chunks_written_;  // See stopAfterChunks().
+  vector<uint64_t> moduli_;
+  // chunk_of_[k] is the index of the modulus that position k divides, and chunk_of_[base_ + 1]
+  // is the number of them.
+  vector<size_t> chunk_of_;
+  vector<FastMod> chunk_divisors_;
+  vector<uint64_t> level_sizes_;
+  // When not spilling, the frontier of the length being expanded and the one being built, and
+  // for the prefixes of length n, parents_[n][i] is the index of prefix i's parent among those
+  // of length n - 1, and last_digits_[n][i] is its last digit.  Every base we can search is
+  // under 256, so a digit fits in a byte.
+  vector<Frontier> chunks_[2];
+  vector<vector<uint64_t>> parents_;
+  vector<vector<uint8_t>> last_digits_;
+  vector<vector<uint16_t>> solutions_;
+
+  bool spilling() const { return !spill_dir_.empty(); }
+
+  // The chunks that prefixes of length len need, which are the ones that cover positions after theirs.
+  size_t firstChunk(size_t len) const { return chunk_of_[len + 1]; }
+
+  // Build the prefixes of length progress->len + 1 from those of length progress->len, one
+  // chunk at a time, in two passes.  The first works out which children each prefix has, the
+  // same way TreeSearch::expand() does, and the second fills in the children's fields one
+  // array at a time.  Returns false if stopped by stopAfterChunks().
+  bool expandLevel(Progress* progress)
+  {
+    size_t len = progress->len;
+    size_t pos = len + 1;
+    const FastMod& divisor = place_residues_.divisor(pos);
+    bool forward_check = pos + 1 < base_;
+    if (progress->chunks_done == 0)
+      level_sizes_[pos] = 0;
+
+    while (progress->chunks_done < progress->num_chunks) {
+      Frontier frontier;
+      getChunk(len, progress->chunks_done, &frontier);
+      uint64_t num_prefixes = frontier.size();
+      const vector<uint64_t>& pos_residues = frontier.residues[chunk_of_[pos]];
+
+      vector<DigitSet<W>> children(num_prefixes);
+      uint64_t num_children = 0;
+      for (uint64_t i = 0; i < num_prefixes; ++i) {
+        DigitSet<W> used;
+        for (int w = 0; w < W; ++w)
+          used.words()[w] = frontier.used[w][i];
+        uint64_t needed = nextDigitResidue(place_residues_, pos, divisor.mod(pos_residues[i]));
+        DigitSet<W> candidates = (tables_.allowed(pos) - used) & tables_.progressions(pos)[needed];
+
+        // Forward checking: drop the digits that would leave nothing to put in the position after.
+        if (forward_check && !candidates.empty()) {
+          const FastMod& next_divisor = place_residues_.divisor(pos + 1);
+          uint64_t next_residue = next_divisor.mod(frontier.residues[chunk_of_[pos + 1]][i]);
+          DigitSet<W> next_unused = tables_.allowed(pos + 1) - used;
+          candidates = forwardCheck(candidates, next_unused, tables_.progressions(pos + 1),
+                                    place_residues_, pos, next_residue);
+        }
+        children[i] = candidates;
+        num_children += candidates.size();
+      }
+
+      // Write the children out a chunk at a time.
+      uint64_t i = 0;
+      while (num_children > 0) {
+        uint64_t size = min(num_children, chunk_size_);
+        num_children -= size;
+        vector<uint64_t> parents(size);
+        vector<uint8_t> digits(size);
+        for (uint64_t j = 0; j < size; ++j) {
+          while (children[i].empty())
+            ++i;
+          parents[j] = i;
+          digits[j] = children[i].popFront();
+        }
+
+        Frontier next;
+        for (int w = 0; w < W; ++w) {
+          const vector<uint64_t>& used = frontier.used[w];
+          vector<uint64_t>& child_used = next.used[w];
+          child_used.resize(size);
+          for (uint64_t j = 0; j < size; ++j) {
+            uint64_t bit = (digits[j] / 64 == w) ? uint64_t(1) << (digits[j] % 64) : 0;
+            child_used[j] = used[parents[j]] | bit;
+          }
+        }
+
+        next.residues.resize(moduli_.size());
+        for (size_t c = firstChunk(pos); c < moduli_.size(); ++c) {
+          const vector<uint64_t>& residues = frontier.residues[c];
+          vector<uint64_t>& child_residues = next.residues[c];
+          const FastMod& chunk_divisor = chunk_divisors_[c];
+          child_residues.resize(size);
+          for (uint64_t j = 0; j < size; ++j)
+            child_residues[j] = chunk_divisor.mod(residues[parents[j]] * base_ + digits[j]);
+        }
+
+        // Parents are numbered among all the prefixes of their length, not just this chunk's.
+        for (uint64_t j = 0; j < size; ++j)
+          parents[j] += progress->prefixes_done;
+        appendPath(pos, &parents, &digits);
+        level_sizes_[pos] += size;
+        putChunk(pos, progress->num_output_chunks++, &next);
+        if (++num_chunks_written_ == max_chunks_written_)
+          return false;
+      }
+
+      ++progress->chunks_done;
+      progress->prefixes_done += num_prefixes;
+      saveProgress(*progress);
+    }
+    return true;
+  }
+
+  string chunkFile(size_t len, size_t index) const
+  {
+    return spill_dir_ + "/length-" + to_string(len) + "-" + to_string(index) + ".frontier";
+  }
+
+  string pathFile(size_t len, const string& field) const
+  {
+    return spill_dir_ + "/length-" + to_string(len) + "." + field;
+  }
+
+  void putChunk(size_t len, size_t index, Frontier* chunk)
+  {
+    if (!spilling()) {
+      vector<Frontier>& chunks = chunks_[len % 2];
+      if (index == 0)
+        chunks.clear();
+      chunks.push_back(Frontier());
+      swap(chunks.back(), *chunk);
+      return;
     }
-    
-    // Also check for overflow if we form the max allowed number.
-    // Not guaranteed...
-    BigUInt val = 0;
-    for (int i = 0; i < base_; ++i) {
-      BigUInt prev_val = val;
-      val += i * place_values_[base_ - i - 1];
-      assert(val >= prev_val);
+    ofstream out(chunkFile(len, index).c_str(), ios::binary);
+    uint64_t size = chunk->size();
+    out.write((const char*)&size, sizeof(size));
+    for (int w = 0; w < W; ++w)
+      out.write((const char*)chunk->used[w].data(), size * sizeof(uint64_t));
+    for (size_t c = firstChunk(len); c < moduli_.size(); ++c)
+      out.write((const char*)chunk->residues[c].data(), size * sizeof(uint64_t));
+    if (!out) {
+      cout << "Couldn't write " << chunkFile(len, index) << "." << endl;
+      exit(1);
     }
   }
 
-  // Add a new digit to the end of our number and update everything
-  // associated with that.
-  void push(uint16_t digit)
+  void getChunk(size_t len, size_t index, Frontier* chunk)
   {
-    digits_.push_back(digit);
-    used_[digit] = true;
+    if (!spilling()) {
+      swap(*chunk, chunks_[len % 2][index]);
+      return;
+    }
+    ifstream in(chunkFile(len, index).c_str(), ios::binary);
+    uint64_t size = 0;
+    in.read((char*)&size, sizeof(size));
+    for (int w = 0; w < W; ++w) {
+      chunk->used[w].resize(size);
+      in.read((char*)chunk->used[w].data(), size * sizeof(uint64_t));
+    }
+    chunk->residues.resize(moduli_.size());
+    for (size_t c = firstChunk(len); c < moduli_.size(); ++c) {
+      chunk->residues[c].resize(size);
+      in.read((char*)chunk->residues[c].data(), size * sizeof(uint64_t));
+    }
+    if (!in) {
+      cout << "Couldn't read " << chunkFile(len, index) << "." << endl;
+      exit(1);
+    }
+  }
 
-    // Zero is a special case that is only tried as the last digit.
-    if (digit == 0) {
-      assert((uint16_t)digits_.size() == base_);
-      mat_(base_-1, base_-1) = 1;
+  // Delete the chunks of prefixes of length len, including any left over from a search that
+  // was killed before it could record them.
+  void dropLevel(size_t len, size_t num_chunks)
+  {
+    if (!spilling()) {
+      chunks_[len % 2].clear();
+      return;
     }
-    else 
-      mat_(digit-1, digits_.size()-1) = 1;
-    
-    value_ = digits2Val(digits_);
-    num_evals_++;
+    for (size_t index = 0; ; ++index)
+      if (remove(chunkFile(len, index).c_str()) != 0 && index >= num_chunks)
+        break;
+  }
 
-    if (verbose_) {
-      cout << "--------------" << endl;
-      cout << "Evaluating..." << endl;
-      cout << "--------------" << endl;
-      cout << "digits_ " << digits_ << endl;
-      cout << "place_values_ " << place_values_ << endl;
-      cout << "used_ " << used_ << endl;
-      cout << "value_ " << value_ << endl;
-      cout << "mat_ " << endl << mat_ << endl;
-      cin.get();
+  void appendPath(size_t len, vector<uint64_t>* parents, vector<uint8_t>* digits)
+  {
+    if (!spilling()) {
+      parents_[len].insert(parents_[len].end(), parents->begin(), parents->end());
+      last_digits_[len].insert(last_digits_[len].end(), digits->begin(), digits->end());
+      return;
+    }
+    ios::openmode mode = ios::binary | (level_sizes_[len] == 0 ? ios::trunc : ios::app);
+    ofstream parents_out(pathFile(len, "parents").c_str(), mode);
+    parents_out.write((const char*)parents->data(), parents->size() * sizeof(uint64_t));
+    ofstream digits_out(pathFile(len, "digits").c_str(), mode);
+    digits_out.write((const char*)digits->data(), digits->size());
+    if (!parents_out || !digits_out) {
+      cout << "Couldn't write " << pathFile(len, "parents") << "." << endl;
+      exit(1);
     }
   }
 
-  // Pop the last digit off the end of our number and undo all the updates
-  // we made in push().
-  void pop()
+  // The parent and last digit of prefix index among those of length len.
+  void pathAt(size_t len, uint64_t index, uint64_t* parent, uint8_t* digit)
   {
-    uint16_t digit = digits_.back();
-    if (digit == 0)
-      mat_(base_-1, base_-1) = 0;
-    else
-      mat_(digit-1, digits_.size()-1) = 0;
-    
-    digits_.resize(digits_.size() - 1);
-    used_[digit] = false;
-    value_ = digits2Val(digits_);
+    if (!spilling()) {
+      *parent = parents_[len][index];
+      *digit = last_digits_[len][index];
+      return;
+    }
+    ifstream parents_in(pathFile(len, "parents").c_str(), ios::binary);
+    parents_in.seekg(index * sizeof(uint64_t));
+    parents_in.read((char*)parent, sizeof(*parent));
+    ifstream digits_in(pathFile(len, "digits").c_str(), ios::binary);
+    digits_in.seekg(index);
+    digits_in.read((char*)digit, sizeof(*digit));
   }
-  
-  BigUInt search()
-  { 
-    // If there's only one digit left, we know it has to be zero.
-    if (digits_.size() == place_values_.size() - 1) {
-      push(0);
 
-      if (value_ % digits_.size() == 0) {
-        MatrixXi m = digits2Matrix(digits_);
-        assert(m.isApprox(mat_));
-        cout << "Solution: " << digits_ << " (" << value_ << ")"
-             << " [Symmetric: " << m.isApprox(m.transpose()) << "]"
-             << " [Symmetry violation: " << symmetryViolation(mat_) << "]" << endl;
-        cout << mat_ << endl;
+  // Like Checkpoint::save(), writes to a temporary file first.
+  void saveProgress(const Progress& progress)
+  {
+    if (!spilling())
+      return;
+    string path = spill_dir_ + "/progress";
+    string tmp_path = path + ".tmp";
+    {
+      ofstream out(tmp_path.c_str());
+      out << "treesearch-frontier 1" << endl;
+      out << "base " << base_ << endl;
+      out << "length " << progress.len << endl;
+      out << "chunks " << progress.num_chunks << " " << progress.chunks_done << " "
+          << progress.prefixes_done << endl;
+      out << "output_chunks " << progress.num_output_chunks << endl;
+      out << "level_sizes " << level_sizes_.size();
+      for (size_t i = 0; i < level_sizes_.size(); ++i)
+        out << " " << level_sizes_[i];
+      out << endl;
+      if (!out) {
+        cout << "Couldn't write " << tmp_path << "." << endl;
+        exit(1);
       }
-      
-      pop();
-      return num_evals_;
     }
+    rename(tmp_path.c_str(), path.c_str());
+  }
 
-    // Otherwise, try adding digits that haven't been used yet, and recursively search if they work.
-    // We know zero is always the last digit, so don't bother searching over that.
-    for (size_t digit = 1; digit < place_values_.size(); ++digit) {
-      if (used_[digit])
-        continue;
+  bool loadProgress(Progress* progress)
+  {
+    ifstream in((spill_dir_ + "/progress").c_str());
+    string magic, key;
+    int version = 0;
+    uint16_t base = 0;
+    size_t num_sizes = 0;
+    in >> magic >> version;
+    if (magic != "treesearch-frontier" || version != 1)
+      return false;
+    in >> key >> base >> key >> progress->len
+       >> key >> progress->num_chunks >> progress->chunks_done >> progress->prefixes_done
+       >> key >> progress->num_output_chunks >> key >> num_sizes;
+    if (!in || base != base_ || num_sizes != level_sizes_.size())
+      return false;
+    for (size_t i = 0; i < num_sizes; ++i)
+      in >> level_sizes_[i];
+    return (bool)in;
+  }
+};
 
-      // In heuristic search, we only try alternating odd / even sequences.
-      if (heuristic_)
-        if (digits_.size() % 2 == digit % 2)
-          continue;
+struct SearchOptions
+{
+  uint16_t base;
+  bool heuristic;
+  int max_symmetry_violation;
+  bool involution;  // Heuristic with no symmetry violation, only generating involutions.
+  bool all_thresholds;  // Report a heuristic search's results for every threshold up to its own.
+  // If not -1, raise the max symmetry violation one at a time up to this until there's a solution.
+  int escalate_limit;
+  size_t meet_depth;  // If nonzero, meet in the middle at this depth.  See MeetInTheMiddle.
+  bool breadth_first;  // Use BreadthFirstSearch.
+  // If not empty, BreadthFirstSearch keeps its frontier here, in chunks of about memory_budget bytes.
+  string spill_dir;
+  uint64_t memory_budget;
+  bool resume_spilled;  // Pick up the breadth-first search in spill_dir where it left off.
+  // If nonzero, estimate the search from this many of TreeSearch::probe() rather than running it.
+  uint64_t estimate_probes;
+  bool importance_sampling;
+  bool verbose;
+  int num_threads;
+  string checkpoint_path;  // Empty if not checkpointing.
+  double checkpoint_interval;  // Seconds.
+  const Checkpoint* resume_from;  // NULL if starting from scratch.
+  // Only search the shard_index'th of num_shards equal slices of the tree.
+  int shard_index;
+  int num_shards;
+};
 
-      push(digit);
+// Break down the results of a heuristic search by max symmetry violation, giving what a
+// search with each threshold up to the one it was run with would have reported.
+void printThresholds(const vector<uint64_t>& evals_by_threshold,
+                     const vector<vector<uint16_t>>& solutions)
+{
+  vector<int> solution_violations;
+  for (size_t i = 0; i < solutions.size(); ++i)
+    solution_violations.push_back(pathViolation(solutions[i]));
 
-      // Check the main divisibility constraint.
-      // If we pass, and we're doing an exhaustive search, then continue searching down this branch.
-      // If we pass, and we're doing a heuristic search, check for symmetry first.
-      if (value_ % digits_.size() == 0) {
-        if (!heuristic_)
-          search();
-        else {
-          const MatrixXi& block = mat_.block(0, 0, digits_.size(), digits_.size());
-          if (symmetryViolation(block) <= max_symmetry_violation_)
-            search();
-        }
-      }
+  uint64_t num_evals = 0;
+  for (size_t t = 0; t < evals_by_threshold.size(); ++t) {
+    num_evals += evals_by_threshold[t];
+    size_t num_solutions = count_if(solution_violations.begin(), solution_violations.end(),
+                                    [t](int violation) { return violation <= (int)t; });
+    cout << "Max symmetry violation " << t << ": " << num_solutions << " solutions, "
+         << num_evals << " evals" << endl;
+  }
+}
 
-      pop();
+// Fill in checkpoint's tasks, and its totals from above them, for shard shard_index of
+// num_shards, and return how many tasks there are over all the shards.  Every shard makes the
+// same split, since it only depends on num_shards, and takes every num_shards'th task.  The
+// nodes above the split are counted by shard 0 alone, so adding up num evals over all the
+// shards gives the same total as an unsharded run.
+template<typename TS>
+size_t splitShard(TS* root, int shard_index, int num_shards, Checkpoint* checkpoint)
+{
+  vector<SearchTask> tasks = root->split(64 * num_shards);
+  for (size_t i = shard_index; i < tasks.size(); i += num_shards)
+    checkpoint->tasks.push_back(tasks[i]);
+  checkpoint->num_evals = 0;
+  checkpoint->evals_by_threshold.assign(root->evalsByThreshold().size(), 0);
+  if (shard_index == 0) {
+    checkpoint->num_evals = root->numEvals();
+    checkpoint->evals_by_threshold = root->evalsByThreshold();
+    checkpoint->solutions = root->solutions();
+  }
+  return tasks.size();
+}
+
+// Split the tree into more tasks than threads, and let the threads share them out
+// by work stealing.  Each thread has its own TreeSearch, so nothing in the node loop is shared.
+// Solutions are printed at the end, in the same order a single-threaded search finds them.
+//
+// If checkpointing, the main thread wakes up every so often, pauses the workers,
+// and saves all their unfinished work along with the queued tasks.
+template<typename Tracker, int W, bool Heuristic, bool Involution>
+uint64_t runParallelSearch(const SearchOptions& opts)
+{
+  TreeSearch<Tracker, W, Heuristic, Involution> root(opts.base, opts.max_symmetry_violation, false);
+  vector<TreeSearch<Tracker, W, Heuristic, Involution>> searchers(opts.num_threads, root);
+  Checkpoint checkpoint;
+  if (opts.resume_from)
+    checkpoint = *opts.resume_from;
+  else {
+    // Only a few tasks are needed up front, since running threads split off more
+    // as soon as any thread runs out of work.
+    checkpoint.base = opts.base;
+    checkpoint.heuristic = opts.heuristic;
+    checkpoint.max_symmetry_violation = opts.max_symmetry_violation;
+    checkpoint.involution = opts.involution;
+    checkpoint.shard_index = opts.shard_index;
+    checkpoint.num_shards = opts.num_shards;
+    if (opts.num_shards == 1) {
+      checkpoint.tasks = root.split(4 * opts.num_threads);
+      checkpoint.num_evals = root.numEvals();
+      checkpoint.evals_by_threshold = root.evalsByThreshold();
+      checkpoint.solutions = root.solutions();
     }
+    else {
+      size_t num_tasks = splitShard(&root, opts.shard_index, opts.num_shards, &checkpoint);
+      cout << "Shard " << opts.shard_index << "/" << opts.num_shards << " has "
+           << checkpoint.tasks.size() << " of " << num_tasks << " subtrees." << endl;
+    }
+  }
+  
+  TaskPool pool(opts.num_threads);
+  for (size_t i = 0; i < checkpoint.tasks.size(); ++i)
+    pool.add(i % opts.num_threads, checkpoint.tasks[i]);
 
-    return num_evals_;
+  vector<thread> threads;
+  for (int i = 0; i < opts.num_threads; ++i) {
+    threads.push_back(thread([&, i]() {
+          searchers[i].setPool(&pool, i);
+          SearchTask task;
+          while (pool.next(i, &task))
+            searchers[i].search(task);
+        }));
   }
-    
-private:
-  uint16_t base_;
-  bool heuristic_;
-  int max_symmetry_violation_;
-  bool verbose_;
-  BigUInt value_;
-  vector<BigUInt> place_values_;  // place_values_[i] is base_^i.
-  vector<uint16_t> digits_;  // The number, in order of most significant to least significant
-  vector<bool> used_;  // used_[i] == true if i appears in the number so far.
-  BigUInt num_evals_;
-  // Matrix form of the solution so far.
-  // Each column corresponds to one digit.
-  // Is a fixed size base_ x base_, all zeros to start, with ones filled in as digits_ grows.
-  MatrixXi mat_;
+
+  // Totals from everything up to now, on top of those from before the run.
+  auto snapshot = [&]() {
+    Checkpoint snap = checkpoint;
+    snap.tasks = pool.queuedTasks();
+    for (size_t i = 0; i < searchers.size(); ++i) {
+      vector<SearchTask> frontier = searchers[i].frontier();
+      snap.tasks.insert(snap.tasks.end(), frontier.begin(), frontier.end());
+      snap.num_evals += searchers[i].numEvals();
+      const vector<uint64_t>& evals_by_threshold = searchers[i].evalsByThreshold();
+      snap.evals_by_threshold.resize(max(snap.evals_by_threshold.size(), evals_by_threshold.size()), 0);
+      for (size_t t = 0; t < evals_by_threshold.size(); ++t)
+        snap.evals_by_threshold[t] += evals_by_threshold[t];
+      snap.solutions.insert(snap.solutions.end(),
+                            searchers[i].solutions().begin(), searchers[i].solutions().end());
+    }
+    sort(snap.solutions.begin(), snap.solutions.end());
+    return snap;
+  };
   
-  BigUInt digits2Val(const std::vector<uint16_t>& digits)
-  {
-    BigUInt val = 0;
-    size_t idx = place_values_.size() - digits.size();
-    for (size_t i = 0; i < digits.size(); ++i, ++idx)
-      val += digits[i] * place_values_[idx];
+  if (!opts.checkpoint_path.empty()) {
+    chrono::duration<double> interval(opts.checkpoint_interval);
+    while (!pool.waitUntilDone(interval)) {
+      pool.pause();
+      if (!snapshot().save(opts.checkpoint_path))
+        cout << "Couldn't write checkpoint " << opts.checkpoint_path << "." << endl;
+      pool.resume();
+    }
+  }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
 
-    return val;
+  // Also save the finished search, so resuming it just reports the results.
+  Checkpoint result = snapshot();
+  if (!opts.checkpoint_path.empty())
+    result.save(opts.checkpoint_path);
+  
+  for (size_t i = 0; i < result.solutions.size(); ++i)
+    root.printSolution(result.solutions[i]);
+  if (opts.all_thresholds)
+    printThresholds(result.evals_by_threshold, result.solutions);
+  return result.num_evals;
+}
+
+// Estimate how many evals the search would do from random probes, and how long it would take
+// from how fast the real search goes for its first second or so.  Returns the evals done
+// measuring that.
+template<typename Tracker, int W, bool Heuristic, bool Involution>
+uint64_t runEstimate(const SearchOptions& opts)
+{
+  // Probe in parallel, each thread with its own searcher and random numbers.
+  vector<vector<double>> estimates(opts.num_threads);
+  vector<thread> threads;
+  auto probe_start = chrono::steady_clock::now();
+  for (int i = 0; i < opts.num_threads; ++i) {
+    threads.push_back(thread([&, i]() {
+          TreeSearch<Tracker, W, Heuristic, Involution> ts(opts.base, opts.max_symmetry_violation,
+                                                           false);
+          mt19937_64 rng(i);
+          for (uint64_t probe = i; probe < opts.estimate_probes; probe += opts.num_threads)
+            estimates[i].push_back(ts.probe(&rng, opts.importance_sampling));
+        }));
   }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  double probe_seconds = chrono::duration<double>(chrono::steady_clock::now() - probe_start).count();
 
-  MatrixXi digits2Matrix(const std::vector<uint16_t>& digits)
-  {
-    MatrixXi m = MatrixXi::Zero(digits.size(), digits.size());
-    for (size_t i = 0; i < digits.size(); ++i) {
-      // Ignore out of bounds digits.
-      if (digits[i] >= m.rows())
-        continue;
-      else if (digits[i] != 0)
-        m(digits[i] - 1, i) = 1;
-      else
-        m(digits.size() - 1, i) = 1;
+  // The estimates are independent, so the mean is normal-ish for enough of them, with the
+  // standard error as its standard deviation.  They're heavy-tailed, though, so a small
+  // number of probes tends to underestimate, and its interval is too narrow.
+  double n = opts.estimate_probes;
+  double sum = 0, sum_squares = 0;
+  for (size_t i = 0; i < estimates.size(); ++i) {
+    for (size_t j = 0; j < estimates[i].size(); ++j) {
+      sum += estimates[i][j];
+      sum_squares += estimates[i][j] * estimates[i][j];
     }
-    return m;
+  }
+  double mean = sum / n;
+  double variance = n > 1 ? max(sum_squares - n * mean * mean, 0.0) / (n - 1) : 0;
+  double margin = 1.96 * sqrt(variance / n);
+  double low = max(mean - margin, 0.0);
+  double high = mean + margin;
+
+  // Time the real search, single-threaded.
+  TreeSearch<Tracker, W, Heuristic, Involution> ts(opts.base, opts.max_symmetry_violation, false);
+  auto search_start = chrono::steady_clock::now();
+  double search_seconds = 0;
+  bool done = !ts.start(SearchTask());
+  while (!done && search_seconds < 1) {
+    done = ts.run(ts.numEvals() + 100000);
+    search_seconds = chrono::duration<double>(chrono::steady_clock::now() - search_start).count();
+  }
+  ts.finish();
+  double evals_per_second = ts.numEvals() / max(search_seconds, 1e-9);
+
+  cout << "Estimated num evals: " << mean << ", 95% confidence interval " << low << " to " << high
+       << ", from " << opts.estimate_probes << (opts.importance_sampling ? " importance-sampled" : "")
+       << " probes in " << probe_seconds << " seconds." << endl;
+  cout << "The search does " << evals_per_second << " evals per second per thread." << endl;
+  double rate = evals_per_second * opts.num_threads;
+  cout << "Estimated time with " << opts.num_threads << " thread" << (opts.num_threads > 1 ? "s" : "")
+       << ": " << mean / rate << " seconds, 95% confidence interval " << low / rate << " to "
+       << high / rate << (opts.num_threads > 1 ? ", if the threads scale perfectly." : ".") << endl;
+  if (done)
+    cout << "The search finished while being timed, with " << ts.numEvals() << " evals." << endl;
+  return ts.numEvals();
+}
+
+// Search with ts's max symmetry violation, which is threshold, and if there's no solution, raise
+// it one at a time up to limit until there is.  Returns the threshold it stopped at.
+// Each step only searches below the nodes the last one cut off for being one violation too
+// asymmetric, so the whole escalation visits the same nodes as one search at the final threshold.
+template<typename TS>
+int escalate(TS* ts, int threshold, int limit, bool print_progress = true)
+{
+  ts->recordCuts(limit);
+  ts->search();
+  while (ts->solutions().empty() && threshold < limit) {
+    ++threshold;
+    if (print_progress)
+      cout << "No solutions with max symmetry violation " << threshold - 1 << " after "
+           << ts->numEvals() << " evals.  Trying " << threshold << "." << endl;
+    ts->setMaxSymmetryViolation(threshold);
+    ts->searchCuts(threshold);
+  }
+  return threshold;
+}
+
+// Search, and with --escalate, keep raising the max symmetry violation until there's a solution.
+template<typename TS>
+void searchAndEscalate(TS* ts, const SearchOptions& opts)
+{
+  if (opts.escalate_limit < 0) {
+    ts->search();
+    return;
+  }
+
+  int threshold = escalate(ts, opts.max_symmetry_violation, opts.escalate_limit);
+  cout << "Stopped escalating at max symmetry violation " << threshold << "." << endl;
+}
+
+template<typename Tracker, int W, bool Heuristic, bool Involution>
+uint64_t runModeSearch(const SearchOptions& opts)
+{
+  if (opts.estimate_probes > 0)
+    return runEstimate<Tracker, W, Heuristic, Involution>(opts);
+  if (opts.num_threads > 1 || !opts.checkpoint_path.empty() || opts.num_shards > 1)
+    return runParallelSearch<Tracker, W, Heuristic, Involution>(opts);
+
+  if (opts.verbose) {
+    TreeSearch<Tracker, W, Heuristic, Involution, true> ts(opts.base, opts.max_symmetry_violation);
+    searchAndEscalate(&ts, opts);
+    if (opts.all_thresholds)
+      printThresholds(ts.evalsByThreshold(), ts.solutions());
+    return ts.numEvals();
+  }
+  TreeSearch<Tracker, W, Heuristic, Involution> ts(opts.base, opts.max_symmetry_violation);
+  searchAndEscalate(&ts, opts);
+  if (opts.all_thresholds)
+    printThresholds(ts.evalsByThreshold(), ts.solutions());
+  return ts.numEvals();
+}
+
+template<int W>
+uint64_t runMeetInTheMiddle(const SearchOptions& opts)
+{
+  MeetInTheMiddle<ResidueTracker, W> mitm(opts.base, opts.meet_depth);
+  mitm.search();
+  cout << "Met in the middle at depth " << opts.meet_depth << ": " << mitm.numPrefixes()
+       << " prefixes in " << mitm.numStates() << " states, " << mitm.solutions().size()
+       << " solutions." << endl;
+  return mitm.numEvals();
+}
+
+// Also prints how many prefixes of each length there are, next to the estimate from
+// tree() in plot_scaling.py: (base - 1)(base - 2)...(base - n) / (n - 1)! for length n.
+template<int W>
+uint64_t runBreadthFirstSearch(const SearchOptions& opts)
+{
+  BreadthFirstSearch<W> bfs(opts.base, true, opts.spill_dir, opts.memory_budget);
+  if (!bfs.search(opts.resume_spilled)) {
+    cout << "Couldn't find a breadth-first search for base " << opts.base << " to resume in "
+         << opts.spill_dir << "." << endl;
+    exit(1);
+  }
+  double model = 1;
+  for (size_t n = 1; n <= opts.base; ++n) {
+    model *= double(opts.base - n) / max<size_t>(n - 1, 1);
+    cout << "Length " << n << ": " << bfs.levelSizes()[n] << " prefixes (tree() model: "
+         << model << ")" << endl;
+  }
+  return bfs.numEvals();
+}
+
+// Pick the kind of search at compile time, so the node loop doesn't have to check it.
+template<typename Tracker, int W>
+uint64_t runSearch(const SearchOptions& opts)
+{
+  if (opts.involution)
+    return runModeSearch<Tracker, W, true, true>(opts);
+  if (opts.heuristic)
+    return runModeSearch<Tracker, W, true, false>(opts);
+  return runModeSearch<Tracker, W, false, false>(opts);
+}
+
+// Meeting in the middle and breadth-first search never need exact values, so they always
+// track residues, and are only built once for each digit set width rather than for every
+// value type too.
+template<int W>
+uint64_t runResidueSearch(const SearchOptions& opts)
+{
+  if (opts.breadth_first)
+    return runBreadthFirstSearch<W>(opts);
+  if (opts.meet_depth > 0)
+    return runMeetInTheMiddle<W>(opts);
+  return runSearch<ResidueTracker, W>(opts);
+}
+
+// Digit sets only need more than one word for bases over 64.
+uint64_t runResidueSearch(const SearchOptions& opts)
+{
+  if (opts.base <= 64)
+    return runResidueSearch<1>(opts);
+  if (opts.base <= 128)
+    return runResidueSearch<2>(opts);
+  return runResidueSearch<3>(opts);
+}
+
+// Use the narrowest integer type that can hold every number in this base.
+// All the bases that fit in up to 256 bits are under 64, so their digit sets fit in one word.
+uint64_t runValueSearch(const SearchOptions& opts)
+{
+  using namespace boost::multiprecision;
+  if (opts.breadth_first || opts.meet_depth > 0)
+    return runResidueSearch(opts);
+  if (fitsBase<uint64_t>(opts.base))
+    return runSearch<ValueTracker<uint64_t>, 1>(opts);
+  if (fitsBase<unsigned __int128>(opts.base))
+    return runSearch<ValueTracker<unsigned __int128>, 1>(opts);
+  if (fitsBase<uint256_t>(opts.base))
+    return runSearch<ValueTracker<uint256_t>, 1>(opts);
+  if (fitsBase<uint512_t>(opts.base)) {
+    if (opts.base <= 64)
+      return runSearch<ValueTracker<uint512_t>, 1>(opts);
+    return runSearch<ValueTracker<uint512_t>, 2>(opts);
+  }
+  if (opts.base <= 128)
+    return runSearch<ValueTracker<uint1024_t>, 2>(opts);
+  return runSearch<ValueTracker<uint1024_t>, 3>(opts);
+}
+
+// What a search found, for comparing searches that should agree: its num evals, and its
+// solutions, sorted so that the order they were found in doesn't matter.
+struct SearchResult
+{
+  uint64_t num_evals = 0;
+  vector<vector<uint16_t>> solutions;
+
+  // Add in the evals and solutions of part of the search.
+  void add(uint64_t evals, const vector<vector<uint16_t>>& found)
+  {
+    num_evals += evals;
+    solutions.insert(solutions.end(), found.begin(), found.end());
+    sort(solutions.begin(), solutions.end());
+  }
+
+  bool operator==(const SearchResult& other) const
+  {
+    return num_evals == other.num_evals && solutions == other.solutions;
   }
 };
 
-void testSymmetry()
+// Works for TreeSearch, MeetInTheMiddle and BreadthFirstSearch.
+template<typename Search>
+SearchResult resultOf(const Search& search)
+{
+  SearchResult result;
+  result.add(search.numEvals(), search.solutions());
+  return result;
+}
+
+// The plain single-threaded search the other ways of searching are checked against.
+template<bool Heuristic, bool Involution = false>
+SearchResult referenceSearch(uint16_t base, int max_symmetry_violation)
+{
+  TreeSearch<ResidueTracker, 1, Heuristic, Involution> tree(base, max_symmetry_violation, false);
+  tree.search();
+  return resultOf(tree);
+}
+
+// Finish a test's line of output, flagging it if it failed.
+bool reportMatch(bool match)
+{
+  cout << (match ? "" : "  MISMATCH") << endl;
+  return match;
+}
+
+bool testSymmetry()
 {
   MatrixXi m = MatrixXi::Zero(2, 2);
   // m(r, c)
@@ -264,6 +2416,401 @@ void testSymmetry()
   MatrixXi r = MatrixXi::Random(5, 5);
   cout << "Big random matrix: " << endl << r << endl;
   cout << "Symmetry violation: " << symmetryViolation(r) << endl;
+
+  // Working on the digits directly should agree with working on the matrix.
+  vector<uint16_t> digits = {3, 8, 1, 6, 5, 4, 7, 2, 9, 0};
+  mt19937 rng(0);
+  bool match = true;
+  for (int i = 0; i < 5; ++i) {
+    int violation = symmetryViolation(digits);
+    int matrix_violation = symmetryViolation(digits2Matrix(digits));
+    cout << "Digits: " << digits << endl;
+    cout << "Symmetry violation: " << violation << " (matrix: " << matrix_violation << ")";
+    match = reportMatch(violation == matrix_violation) && match;
+    shuffle(digits.begin(), digits.end() - 1, rng);
+  }
+  return match;
+}
+
+// The iterative search should visit exactly the nodes the recursive one does, including when
+// it's stopped every so often, its frontier written out and read back in, and continued.
+template<bool Heuristic>
+bool testIterative(uint16_t base)
+{
+  TreeSearch<ResidueTracker, 1, Heuristic> recursive(base, 2, false);
+  TreeSearch<ResidueTracker, 1, Heuristic> iterative(base, 2, false);
+  recursive.searchRecursive();
+  iterative.search();
+
+  // Stop every 10 nodes, and carry on from the frontier.
+  TreeSearch<ResidueTracker, 1, Heuristic> paused(base, 2, false);
+  vector<SearchTask> tasks(1);
+  while (!tasks.empty()) {
+    SearchTask task = tasks.back();
+    tasks.pop_back();
+    if (paused.start(task) && !paused.run(paused.numEvals() + 10)) {
+      vector<SearchTask> frontier = paused.frontier();
+      tasks.insert(tasks.end(), frontier.begin(), frontier.end());
+    }
+    paused.finish();
+  }
+
+  // The iterative search should also find the solutions in the same order.
+  SearchResult expected = resultOf(recursive);
+  cout << "Base " << base << (Heuristic ? " heuristic" : " exhaustive")
+       << ": recursive " << recursive.numEvals() << " evals, " << recursive.solutions().size()
+       << " solutions; iterative " << iterative.numEvals() << ", " << iterative.solutions().size()
+       << "; paused " << paused.numEvals() << ", " << paused.solutions().size();
+  return reportMatch(recursive.numEvals() == iterative.numEvals() &&
+                     recursive.solutions() == iterative.solutions() &&
+                     resultOf(paused) == expected);
+}
+
+bool testIterative()
+{
+  bool match = true;
+  for (uint16_t base = 2; base <= 16; ++base) {
+    match = testIterative<false>(base) && match;
+    match = testIterative<true>(base) && match;
+  }
+  return match;
+}
+
+// Meeting in the middle should find exactly the solutions the tree search does, at every
+// split depth, and whether or not the prefixes are joined in small batches.
+bool testMeetInTheMiddle()
+{
+  bool all_match = true;
+  for (uint16_t base = 4; base <= 20; ++base) {
+    SearchResult expected = referenceSearch<false>(base, 0);
+    cout << "Base " << base << ": tree " << expected.num_evals << " evals, "
+         << expected.solutions.size() << " solutions; meeting in the middle at depth";
+    bool match = true;
+    for (size_t depth = 1; depth + 2 <= base; ++depth) {
+      for (uint64_t batch_evals : {uint64_t(1) << 22, uint64_t(10)}) {
+        MeetInTheMiddle<ResidueTracker, 1> mitm(base, depth, false, batch_evals);
+        mitm.search();
+        match = match && resultOf(mitm).solutions == expected.solutions;
+        if (batch_evals > 10)
+          cout << " " << depth << ": " << mitm.numEvals();
+      }
+    }
+    all_match = reportMatch(match) && all_match;
+  }
+  return all_match;
+}
+
+// The breadth-first search should visit exactly the nodes the tree search does.
+bool testBreadthFirst()
+{
+  bool match = true;
+  for (uint16_t base = 2; base <= 20; ++base) {
+    SearchResult expected = referenceSearch<false>(base, 0);
+    BreadthFirstSearch<1> bfs(base, false);
+    bfs.search();
+    cout << "Base " << base << ": tree " << expected.num_evals << " evals, "
+         << expected.solutions.size() << " solutions; breadth-first " << bfs.numEvals() << ", "
+         << bfs.solutions().size();
+    match = reportMatch(resultOf(bfs) == expected) && match;
+  }
+  return match;
+}
+
+// Spilling the frontier to disk, in chunks much smaller than a level, should give the same
+// prefixes and solutions as keeping it in memory, including when the search is stopped partway
+// through writing a level and resumed from its progress file.
+bool testSpill()
+{
+  auto file_size = [](const string& path) {
+    ifstream in(path.c_str(), ios::binary | ios::ate);
+    return in ? (uint64_t)in.tellg() : 0;
+  };
+  bool all_match = true;
+  for (uint16_t base : {10, 14, 19}) {
+    BreadthFirstSearch<1> in_memory(base, false);
+    in_memory.search();
+    SearchResult expected = resultOf(in_memory);
+
+    cout << "Base " << base << ": " << expected.num_evals << " evals, "
+         << expected.solutions.size() << " solutions; spilled, and resumed after";
+    bool match = true;
+    // Stopping after 0 chunks means running straight through, without resuming.
+    for (uint64_t stop_after : {0, 1, 5, 40, 100}) {
+      char spill_dir[] = "/tmp/treesearch-test-XXXXXX";
+      if (!mkdtemp(spill_dir)) {
+        cout << "Couldn't make a directory to spill to." << endl;
+        return false;
+      }
+      if (stop_after > 0) {
+        BreadthFirstSearch<1> stopped(base, false, spill_dir, 1);
+        stopped.stopAfterChunks(stop_after);
+        stopped.search();
+      }
+      BreadthFirstSearch<1> spilled(base, false, spill_dir, 1);
+      bool finished = spilled.search(stop_after > 0);
+      match = match && finished && spilled.levelSizes() == in_memory.levelSizes() &&
+        resultOf(spilled) == expected;
+      cout << " " << stop_after;
+
+      // Finishing should have deleted every chunk, leaving only the progress file and the paths,
+      // with nothing left in them from before the resume.
+      for (size_t len = 1; len < base; ++len) {
+        string path = string(spill_dir) + "/length-" + to_string(len);
+        uint64_t size = in_memory.levelSizes()[len];
+        match = match && file_size(path + ".parents") == size * sizeof(uint64_t) &&
+          file_size(path + ".digits") == size;
+        remove((path + ".parents").c_str());
+        remove((path + ".digits").c_str());
+      }
+      remove((string(spill_dir) + "/progress").c_str());
+      match = match && rmdir(spill_dir) == 0;
+    }
+    cout << " chunks";
+    all_match = reportMatch(match) && all_match;
+  }
+  return all_match;
+}
+
+// Averaged over enough probes, Knuth's estimate should come close to the real num evals.
+template<bool Heuristic>
+bool testProbe(uint16_t base)
+{
+  uint64_t num_evals = referenceSearch<Heuristic>(base, 2).num_evals;
+  cout << "Base " << base << (Heuristic ? " heuristic" : " exhaustive") << ": " << num_evals
+       << " evals; estimated";
+  bool close = true;
+  for (bool importance : {false, true}) {
+    TreeSearch<ResidueTracker, 1, Heuristic> prober(base, 2, false);
+    mt19937_64 rng(0);
+    const int num_probes = 20000;
+    double sum = 0;
+    for (int i = 0; i < num_probes; ++i)
+      sum += prober.probe(&rng, importance);
+    double estimate = sum / num_probes;
+    close = close && fabs(estimate - num_evals) <= 0.1 * num_evals;
+    cout << " " << estimate << (importance ? " with importance sampling" : "");
+  }
+  return reportMatch(close);
+}
+
+bool testProbe()
+{
+  bool close = true;
+  for (uint16_t base = 10; base <= 20; ++base) {
+    close = testProbe<false>(base) && close;
+    close = testProbe<true>(base) && close;
+  }
+  return close;
+}
+
+// Only generating involutions should find exactly the solutions a heuristic search with no
+// symmetry violation does.
+bool testInvolution()
+{
+  bool match = true;
+  for (uint16_t base = 4; base <= 24; base += 2) {
+    SearchResult expected = referenceSearch<true>(base, 0);
+    SearchResult found = referenceSearch<true, true>(base, 0);
+    cout << "Base " << base << ": heuristic -s 0 " << expected.num_evals << " evals, "
+         << expected.solutions.size() << " solutions; involution " << found.num_evals << ", "
+         << found.solutions.size();
+    match = reportMatch(found.solutions == expected.solutions) && match;
+  }
+  return match;
+}
+
+// Escalating should visit exactly the nodes, and find exactly the solutions, of one search at
+// the threshold it stops at.
+bool testEscalate()
+{
+  bool match = true;
+  for (uint16_t base = 4; base <= 20; base += 2) {
+    TreeSearch<ResidueTracker, 1, true> escalated(base, 0, false);
+    int threshold = escalate(&escalated, 0, 4, false);
+    SearchResult direct = referenceSearch<true>(base, threshold);
+    cout << "Base " << base << ": escalated to " << threshold << ", " << escalated.numEvals()
+         << " evals, " << escalated.solutions().size() << " solutions; direct "
+         << direct.num_evals << ", " << direct.solutions.size();
+    match = reportMatch(resultOf(escalated) == direct) && match;
+  }
+  return match;
+}
+
+// The evals and solutions a heuristic search bins by threshold should, summed up to each
+// threshold t, match a direct search at t.  That should hold for one search(), for the tasks from
+// split() added up, and for escalating one threshold at a time with searchCuts().
+bool testThresholds(uint16_t base)
+{
+  const int max_violation = 3;
+  auto binned = [](const vector<uint64_t>& evals_by_threshold,
+                   const vector<vector<uint16_t>>& solutions, int t) {
+    SearchResult result;
+    for (int i = 0; i <= t && i < (int)evals_by_threshold.size(); ++i)
+      result.num_evals += evals_by_threshold[i];
+    vector<vector<uint16_t>> found;
+    for (size_t i = 0; i < solutions.size(); ++i)
+      if (pathViolation(solutions[i]) <= t)
+        found.push_back(solutions[i]);
+    result.add(0, found);
+    return result;
+  };
+
+  TreeSearch<ResidueTracker, 1, true> tree(base, max_violation, false);
+  tree.search();
+
+  TreeSearch<ResidueTracker, 1, true> root(base, max_violation, false);
+  vector<SearchTask> tasks = root.split(10);
+  TreeSearch<ResidueTracker, 1, true> worker(base, max_violation, false);
+  for (size_t i = 0; i < tasks.size(); ++i)
+    worker.search(tasks[i]);
+  vector<uint64_t> split_evals = root.evalsByThreshold();
+  for (size_t t = 0; t < split_evals.size(); ++t)
+    split_evals[t] += worker.evalsByThreshold()[t];
+  vector<vector<uint16_t>> split_solutions = root.solutions();
+  split_solutions.insert(split_solutions.end(), worker.solutions().begin(), worker.solutions().end());
+
+  TreeSearch<ResidueTracker, 1, true> escalated(base, 0, false);
+  escalated.recordCuts(max_violation);
+  escalated.search();
+  for (int t = 1; t <= max_violation; ++t) {
+    escalated.setMaxSymmetryViolation(t);
+    escalated.searchCuts(t);
+  }
+
+  cout << "Base " << base << ": evals up to each threshold";
+  bool match = true;
+  for (int t = 0; t <= max_violation; ++t) {
+    SearchResult direct = referenceSearch<true>(base, t);
+    match = match && binned(tree.evalsByThreshold(), tree.solutions(), t) == direct &&
+      binned(split_evals, split_solutions, t) == direct &&
+      binned(escalated.evalsByThreshold(), escalated.solutions(), t) == direct;
+    cout << " " << direct.num_evals;
+  }
+  return reportMatch(match);
+}
+
+bool testThresholds()
+{
+  bool match = true;
+  for (uint16_t base = 4; base <= 18; base += 2)
+    match = testThresholds(base) && match;
+  return match;
+}
+
+// Searching the tasks from split(), or from every shard, should add up to search().
+template<bool Heuristic>
+bool testSplit(uint16_t base)
+{
+  SearchResult expected = referenceSearch<Heuristic>(base, 2);
+  cout << "Base " << base << (Heuristic ? " heuristic" : " exhaustive") << ": "
+       << expected.num_evals << " evals; split into";
+  bool match = true;
+  for (size_t min_tasks : {1, 10, 1000}) {
+    TreeSearch<ResidueTracker, 1, Heuristic> root(base, 2, false);
+    vector<SearchTask> tasks = root.split(min_tasks);
+    TreeSearch<ResidueTracker, 1, Heuristic> worker(base, 2, false);
+    for (size_t i = 0; i < tasks.size(); ++i)
+      worker.search(tasks[i]);
+    SearchResult split = resultOf(root);
+    split.add(worker.numEvals(), worker.solutions());
+    match = match && split == expected;
+    cout << " " << tasks.size();
+  }
+
+  cout << " tasks, and";
+  for (int num_shards : {2, 3}) {
+    SearchResult sharded;
+    for (int shard = 0; shard < num_shards; ++shard) {
+      TreeSearch<ResidueTracker, 1, Heuristic> root(base, 2, false);
+      Checkpoint checkpoint;
+      splitShard(&root, shard, num_shards, &checkpoint);
+      TreeSearch<ResidueTracker, 1, Heuristic> worker(base, 2, false);
+      for (size_t i = 0; i < checkpoint.tasks.size(); ++i)
+        worker.search(checkpoint.tasks[i]);
+      sharded.add(checkpoint.num_evals, checkpoint.solutions);
+      sharded.add(worker.numEvals(), worker.solutions());
+    }
+    match = match && sharded == expected;
+    cout << " " << num_shards;
+  }
+  cout << " shards";
+  return reportMatch(match);
+}
+
+bool testSplit()
+{
+  bool match = true;
+  for (uint16_t base = 4; base <= 16; ++base) {
+    match = testSplit<false>(base) && match;
+    match = testSplit<true>(base) && match;
+  }
+  return match;
+}
+
+// Saving a checkpoint of a search stopped partway through, loading it back in, and searching
+// what's left should add up to search().
+template<bool Heuristic>
+bool testCheckpoint(uint16_t base)
+{
+  TreeSearch<ResidueTracker, 1, Heuristic> tree(base, 2, false);
+  tree.search();
+  SearchResult expected = resultOf(tree);
+  cout << "Base " << base << (Heuristic ? " heuristic" : " exhaustive") << ": "
+       << expected.num_evals << " evals; resumed after";
+
+  char path[] = "/tmp/treesearch-test-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    cout << " nothing, since there's nowhere to save a checkpoint";
+    return reportMatch(false);
+  }
+  close(fd);
+
+  bool match = true;
+  for (uint64_t stop_evals : {uint64_t(1), expected.num_evals / 3, 2 * expected.num_evals / 3}) {
+    TreeSearch<ResidueTracker, 1, Heuristic> stopped(base, 2, false);
+    if (stopped.start(SearchTask()))
+      stopped.run(stop_evals);
+    Checkpoint saved;
+    saved.base = base;
+    saved.heuristic = Heuristic;
+    saved.max_symmetry_violation = 2;
+    saved.involution = false;
+    saved.shard_index = 0;
+    saved.num_shards = 1;
+    saved.num_evals = stopped.numEvals();
+    saved.evals_by_threshold = stopped.evalsByThreshold();
+    saved.solutions = stopped.solutions();
+    saved.tasks = stopped.frontier();
+
+    Checkpoint loaded;
+    match = match && saved.save(path) && loaded.load(path) && loaded.base == base &&
+      loaded.heuristic == Heuristic && loaded.max_symmetry_violation == 2;
+
+    TreeSearch<ResidueTracker, 1, Heuristic> resumed(base, 2, false);
+    for (size_t i = 0; i < loaded.tasks.size(); ++i)
+      resumed.search(loaded.tasks[i]);
+    SearchResult total = resultOf(resumed);
+    total.add(loaded.num_evals, loaded.solutions);
+    vector<uint64_t> evals_by_threshold = loaded.evals_by_threshold;
+    for (size_t t = 0; t < evals_by_threshold.size(); ++t)
+      evals_by_threshold[t] += resumed.evalsByThreshold()[t];
+    match = match && total == expected && evals_by_threshold == tree.evalsByThreshold();
+    cout << " " << loaded.num_evals;
+  }
+  remove(path);
+  cout << " evals";
+  return reportMatch(match);
+}
+
+bool testCheckpoint()
+{
+  bool match = true;
+  for (uint16_t base = 4; base <= 16; ++base) {
+    match = testCheckpoint<false>(base) && match;
+    match = testCheckpoint<true>(base) && match;
+  }
+  return match;
 }
 
 int main(int argc, char** argv)
@@ -272,10 +2819,38 @@ int main(int argc, char** argv)
   optspec.add_options()
     ("b,base", "What base to search", cxxopts::value<int>())
     ("heuristic", "Heuristic search (vs exhaustive search)")
+    ("residues", "Track only machine-word residues of the number rather than its full value")
     ("run-tests", "Run tests")
     ("v,verbose", "Print each step so you can see it working")
+    ("t,threads", "Number of threads to search with", cxxopts::value<int>()->default_value("1"))
+    ("checkpoint", "Periodically save the state of the search to this file",
+     cxxopts::value<string>())
+    ("checkpoint-interval", "Seconds between checkpoints",
+     cxxopts::value<double>()->default_value("600"))
+    ("resume", "Pick up the search from the file given by --checkpoint")
+    ("shard", "Only search slice i of N (counting from 0), e.g. --shard 2/8.  "
+     "Running all N slices covers the tree exactly once.",
+     cxxopts::value<string>()->default_value("0/1"))
     ("s,max-symmetry-violation", "Maximum number of elements allowed to be non-symmetric",
      cxxopts::value<int>()->default_value("0"))
+    ("involution", "Same as --heuristic -s 0, but only generates the symmetric prefixes "
+     "rather than trying every child and checking")
+    ("all-thresholds", "With --heuristic, also report what the search would have found with "
+     "each max symmetry violation from 0 up to -s")
+    ("meet-in-the-middle", "Exhaustive search that collects the prefixes of this length, then "
+     "searches for the suffixes that finish them all at once", cxxopts::value<int>())
+    ("breadth-first", "Exhaustive search that builds all the prefixes of each length at once, "
+     "and prints how many there are")
+    ("spill-dir", "With --breadth-first, keep the prefixes in files in this directory rather than "
+     "in memory.  --resume picks up from the last chunk written there.", cxxopts::value<string>())
+    ("memory-budget", "With --spill-dir, about how many megabytes of prefixes to hold in memory at once",
+     cxxopts::value<double>()->default_value("1024"))
+    ("estimate", "Rather than searching, estimate how many evals the search would do, and how long "
+     "it would take, from this many random probes of the tree", cxxopts::value<int>())
+    ("importance-sampling", "With --estimate, steer the probes towards bigger subtrees")
+    ("escalate", "With --heuristic, if there's no solution, raise -s one at a time up to this "
+     "until there is, only searching below the nodes the last threshold cut off",
+     cxxopts::value<int>())
     ("h,help", "Print usage")
     ;
   
@@ -289,8 +2864,21 @@ int main(int argc, char** argv)
   }
 
   if (opts.count("run-tests")) {
-    testSymmetry();
-    return 0;
+    // Run them all even if one fails, then fail if any did.
+    bool passed = testSymmetry();
+    passed = testIterative() && passed;
+    passed = testMeetInTheMiddle() && passed;
+    passed = testBreadthFirst() && passed;
+    passed = testSpill() && passed;
+    passed = testProbe() && passed;
+    passed = testInvolution() && passed;
+    passed = testEscalate() && passed;
+    passed = testThresholds() && passed;
+    passed = testSplit() && passed;
+    passed = testCheckpoint() && passed;
+    if (!passed)
+      cout << "Some tests failed." << endl;
+    return passed ? 0 : 1;
   }
 
   if (opts.count("help") || !opts.count("base")) {
@@ -298,21 +2886,149 @@ int main(int argc, char** argv)
     return 0;
   }
 
-  uint16_t base = opts["base"].as<int>();
+  // Check the base before narrowing it, so a huge or negative one can't wrap into range.
+  int base_arg = opts["base"].as<int>();
+  if (base_arg < 2 || base_arg > numeric_limits<uint16_t>::max() || !fitsBase<BigUInt>(base_arg)) {
+    cout << "Base must be at least 2, and small enough that base^base fits in 1024 bits." << endl;
+    return 1;
+  }
+  uint16_t base = base_arg;
+
   int max_symmetry_violation = opts["max-symmetry-violation"].as<int>();
   bool heuristic = opts.count("heuristic");
+  bool involution = opts.count("involution");
+  if (involution) {
+    heuristic = true;
+    if (max_symmetry_violation != 0) {
+      cout << "--involution only finds symmetric solutions, so it can't take -s." << endl;
+      return 1;
+    }
+  }
   bool verbose = opts.count("verbose");
-  if (heuristic)
+  bool residues = opts.count("residues");
+  SearchOptions search_opts;
+  search_opts.base = base;
+  search_opts.heuristic = heuristic;
+  search_opts.max_symmetry_violation = max_symmetry_violation;
+  search_opts.involution = involution;
+  search_opts.all_thresholds = opts.count("all-thresholds");
+  if (search_opts.all_thresholds && !heuristic) {
+    cout << "--all-thresholds only applies to heuristic search." << endl;
+    return 1;
+  }
+  search_opts.escalate_limit = -1;
+  if (opts.count("escalate")) {
+    search_opts.escalate_limit = opts["escalate"].as<int>();
+    if (!heuristic || involution || search_opts.escalate_limit < max_symmetry_violation) {
+      cout << "--escalate only applies to heuristic search, and can't be below -s." << endl;
+      return 1;
+    }
+  }
+  search_opts.verbose = verbose;
+  search_opts.num_threads = opts["threads"].as<int>();
+  search_opts.checkpoint_interval = opts["checkpoint-interval"].as<double>();
+  search_opts.resume_from = NULL;
+  if (opts.count("checkpoint"))
+    search_opts.checkpoint_path = opts["checkpoint"].as<string>();
+  char slash = 0;
+  istringstream shard(opts["shard"].as<string>());
+  shard >> search_opts.shard_index >> slash >> search_opts.num_shards;
+  if (!shard || slash != '/' || search_opts.num_shards < 1 ||
+      search_opts.shard_index < 0 || search_opts.shard_index >= search_opts.num_shards) {
+    cout << "--shard must look like i/N, with 0 <= i < N." << endl;
+    return 1;
+  }
+  if (search_opts.num_threads < 1 ||
+      (verbose && (search_opts.num_threads > 1 || !search_opts.checkpoint_path.empty() ||
+                   search_opts.num_shards > 1))) {
+    cout << "--threads must be at least 1, and verbose mode is single-threaded only." << endl;
+    return 1;
+  }
+  search_opts.breadth_first = opts.count("breadth-first");
+  if (search_opts.breadth_first &&
+      (heuristic || verbose || search_opts.num_threads > 1 || !search_opts.checkpoint_path.empty() ||
+       search_opts.num_shards > 1 || opts.count("meet-in-the-middle"))) {
+    cout << "--breadth-first is exhaustive and single-threaded only." << endl;
+    return 1;
+  }
+  if (opts.count("spill-dir"))
+    search_opts.spill_dir = opts["spill-dir"].as<string>();
+  search_opts.memory_budget = opts["memory-budget"].as<double>() * (1 << 20);
+  search_opts.resume_spilled = !search_opts.spill_dir.empty() && opts.count("resume");
+  if (!search_opts.spill_dir.empty() && !search_opts.breadth_first) {
+    cout << "--spill-dir only applies to --breadth-first." << endl;
+    return 1;
+  }
+  search_opts.estimate_probes = 0;
+  search_opts.importance_sampling = opts.count("importance-sampling");
+  if (opts.count("estimate")) {
+    int probes = opts["estimate"].as<int>();
+    if (probes < 1 || verbose || !search_opts.checkpoint_path.empty() || search_opts.num_shards > 1 ||
+        search_opts.breadth_first || search_opts.escalate_limit >= 0 ||
+        opts.count("meet-in-the-middle")) {
+      cout << "--estimate needs at least one probe, and only works with plain tree search." << endl;
+      return 1;
+    }
+    search_opts.estimate_probes = probes;
+  }
+  search_opts.meet_depth = 0;
+  if (opts.count("meet-in-the-middle")) {
+    int depth = opts["meet-in-the-middle"].as<int>();
+    if (depth < 1 || depth + 2 > base) {
+      cout << "--meet-in-the-middle needs a depth from 1 to base - 2." << endl;
+      return 1;
+    }
+    if (heuristic || verbose || search_opts.num_threads > 1 ||
+        !search_opts.checkpoint_path.empty() || search_opts.num_shards > 1) {
+      cout << "--meet-in-the-middle is exhaustive and single-threaded only." << endl;
+      return 1;
+    }
+    search_opts.meet_depth = depth;
+  }
+  if (search_opts.escalate_limit >= 0 &&
+      (search_opts.num_threads > 1 || !search_opts.checkpoint_path.empty() ||
+       search_opts.num_shards > 1)) {
+    cout << "--escalate is single-threaded only." << endl;
+    return 1;
+  }
+
+  Checkpoint checkpoint;
+  if (opts.count("resume") && !search_opts.resume_spilled) {
+    if (search_opts.checkpoint_path.empty() || !checkpoint.load(search_opts.checkpoint_path)) {
+      cout << "Couldn't read a checkpoint to resume from.  Use --checkpoint to say where it is." << endl;
+      return 1;
+    }
+    if (checkpoint.base != base || checkpoint.heuristic != heuristic ||
+        checkpoint.max_symmetry_violation != max_symmetry_violation ||
+        checkpoint.involution != involution ||
+        checkpoint.shard_index != search_opts.shard_index ||
+        checkpoint.num_shards != search_opts.num_shards) {
+      cout << "Checkpoint " << search_opts.checkpoint_path << " is for a different search." << endl;
+      return 1;
+    }
+    search_opts.resume_from = &checkpoint;
+  }
+  if (involution)
+    cout << "Doing involution search on base " << base << ".  "
+         << "This only finds symmetric answers, but can search higher bases." << endl;
+  else if (heuristic)
     cout << "Doing heuristic search on base " << base
          << " with max symmetry violation " << max_symmetry_violation << ".  "
          << "This won't find all answers, but can search higher bases." << endl;
   else
     cout << "Doing exhaustive search on base " << base << ".  " 
          << "If an answer exists, this should find it." << endl;
+  if (search_opts.resume_from)
+    cout << "Resuming from " << search_opts.checkpoint_path << " with " << checkpoint.tasks.size()
+         << " tasks left and " << checkpoint.num_evals << " evals done." << endl;
   
-  TreeSearch ts(base, heuristic, max_symmetry_violation, verbose);
-  BigUInt num_evals = ts.search();
-  cout << "Num evals: " << num_evals << endl;
+  uint64_t num_evals = 0;
+  if (residues)
+    num_evals = runResidueSearch(search_opts);
+  else
+    num_evals = runValueSearch(search_opts);
+  if (search_opts.estimate_probes == 0)
+    cout << "Num evals: " << num_evals << endl;
 
   return 0;
 }